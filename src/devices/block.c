@@ -3,7 +3,37 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Longest time, in timer ticks, that a read or write request
+   may wait in a queue while requests for other sectors are
+   served ahead of it.  Reads usually have a thread waiting for
+   them, so they get the shorter deadline. */
+#define READ_DEADLINE (TIMER_FREQ / 10)
+#define WRITE_DEADLINE (TIMER_FREQ / 2)
+
+/* Most sectors merged into one command from requests whose
+   buffers are not adjacent in memory.  Such requests are copied
+   through a bounce buffer of this size. */
+#define BOUNCE_SECTORS 32
+#define BOUNCE_PAGES (BOUNCE_SECTORS * BLOCK_SECTOR_SIZE / PGSIZE)
+
+/* Queue of requests pending for a block device with a driver,
+   served by the device's own thread. */
+struct block_queue
+  {
+    struct lock lock;                   /* Protects all members. */
+    struct condition not_empty;         /* Signaled when requests arrive. */
+    struct list sorted;                 /* Requests in sector order. */
+    struct list fifo;                   /* Requests in arrival order. */
+    block_sector_t head;                /* Sector after last one served. */
+    bool started;                       /* Service thread created? */
+    uint8_t *bounce;                    /* Bounce buffer, or null. */
+  };
 
 /* A block device. */
 struct block
@@ -19,6 +49,10 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    struct block_queue queue;           /* Pending requests. */
+    unsigned long long request_cnt;     /* Number of requests served. */
+    unsigned long long command_cnt;     /* Number of driver commands. */
   };
 
 /* List of all block devices. */
@@ -28,6 +62,8 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void start_queue (struct block *);
+static thread_func serve_queue NO_RETURN;
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -99,18 +135,15 @@ block_get_by_name (const char *name)
   return NULL;
 }
 
-/* Verifies that SECTOR is a valid offset within BLOCK.
-   Panics if not. */
+/* Verifies that the CNT sectors starting at SECTOR all lie
+   within BLOCK.  Panics if not. */
 static void
-check_sector (struct block *block, block_sector_t sector)
+check_sectors (struct block *block, block_sector_t sector,
+               block_sector_t cnt)
 {
-  if (sector >= block->size)
-    {
-      /* We do not use ASSERT because we want to panic here
-         regardless of whether NDEBUG is defined. */
-      PANIC ("Access past end of device %s (sector=%"PRDSNu", "
-             "size=%"PRDSNu")\n", block_name (block), sector, block->size);
-    }
+  if (cnt > block->size || sector > block->size - cnt)
+    PANIC ("Access past end of device %s (sector=%"PRDSNu", cnt=%"PRDSNu", "
+           "size=%"PRDSNu")\n", block_name (block), sector, cnt, block->size);
 }
 
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
@@ -120,9 +153,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +164,130 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, 1, buffer);
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR from
+   BLOCK into BUFFER, which must have room for CNT *
+   BLOCK_SECTOR_SIZE bytes.  Drivers that support it transfer
+   the whole run with as few commands as possible.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     block_sector_t cnt, void *buffer)
+{
+  struct block_request r;
+
+  block_request_init (&r, false, sector, cnt, buffer, NULL, NULL);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Writes the CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving the
+   data.  Drivers that support it transfer the whole run with as
+   few commands as possible.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      block_sector_t cnt, const void *buffer)
+{
+  struct block_request r;
+
+  block_request_init (&r, true, sector, cnt, (void *) buffer, NULL, NULL);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Initializes R as a request to transfer the CNT sectors
+   starting at SECTOR between a block device and BUFFER, reading
+   from the device if WRITE is false or writing to it if WRITE is
+   true.
+
+   If DONE is non-null, it is called with R, from the device's
+   service thread, once the transfer completes.  R then belongs
+   to DONE, which may free or resubmit it, and block_wait() must
+   not be used on it.  Otherwise, block_wait() waits for R to
+   complete. */
+void
+block_request_init (struct block_request *r, bool write,
+                    block_sector_t sector, block_sector_t cnt, void *buffer,
+                    block_done_func *done, void *aux)
+{
+  ASSERT (r != NULL);
+  ASSERT (cnt > 0);
+  ASSERT (buffer != NULL);
+
+  r->write = write;
+  r->sector = sector;
+  r->cnt = cnt;
+  r->buffer = buffer;
+  r->done = done;
+  r->aux = aux;
+  sema_init (&r->finished, 0);
+}
+
+/* Returns true if request A starts at a lower sector than
+   request B. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a
+    = list_entry (a_, struct block_request, sorted_elem);
+  const struct block_request *b
+    = list_entry (b_, struct block_request, sorted_elem);
+
+  return a->sector < b->sector;
+}
+
+/* Queues request R, which must have been initialized with
+   block_request_init(), for BLOCK and returns without waiting
+   for it to complete. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  struct block_queue *q;
+
+  /* Account for the request at every level, then pass it down to
+     the device that actually has a driver. */
+  for (;;)
+    {
+      check_sectors (block, r->sector, r->cnt);
+      if (r->write)
+        {
+          ASSERT (block->type != BLOCK_FOREIGN);
+          block->write_cnt += r->cnt;
+        }
+      else
+        block->read_cnt += r->cnt;
+
+      if (block->ops->remap == NULL)
+        break;
+      block = block->ops->remap (block->aux, &r->sector);
+    }
+
+  q = &block->queue;
+  r->deadline = timer_ticks () + (r->write ? WRITE_DEADLINE : READ_DEADLINE);
+  lock_acquire (&q->lock);
+  if (!q->started)
+    start_queue (block);
+  list_insert_ordered (&q->sorted, &r->sorted_elem, request_less, NULL);
+  list_push_back (&q->fifo, &r->fifo_elem);
+  cond_signal (&q->not_empty, &q->lock);
+  lock_release (&q->lock);
+}
+
+/* Waits for request R, which must have been submitted without a
+   completion function, to complete. */
+void
+block_wait (struct block_request *r)
+{
+  ASSERT (r->done == NULL);
+  sema_down (&r->finished);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,10 +311,12 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Prints statistics for each block device used for a Pintos
+   role, and for each device whose request queue has been used. */
 void
 block_print_stats (void)
 {
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
@@ -176,6 +329,15 @@ block_print_stats (void)
                   block->read_cnt, block->write_cnt);
         }
     }
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+      if (block->queue.started)
+        printf ("%s: %llu requests in %llu commands\n",
+                block->name, block->request_cnt, block->command_cnt);
+    }
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -192,6 +354,8 @@ block_register (const char *name, enum block_type type,
   if (block == NULL)
     PANIC ("Failed to allocate memory for block device descriptor");
 
+  ASSERT (ops->remap != NULL || (ops->read != NULL && ops->write != NULL));
+
   list_push_back (&all_blocks, &block->list_elem);
   strlcpy (block->name, name, sizeof block->name);
   block->type = type;
@@ -200,6 +364,16 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->request_cnt = 0;
+  block->command_cnt = 0;
+
+  lock_init (&block->queue.lock);
+  cond_init (&block->queue.not_empty);
+  list_init (&block->queue.sorted);
+  list_init (&block->queue.fifo);
+  block->queue.head = 0;
+  block->queue.started = false;
+  block->queue.bounce = NULL;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -221,3 +395,191 @@ list_elem_to_block (struct list_elem *list_elem)
           : NULL);
 }
 
+
+/* Request queues. */
+
+/* Creates the thread that serves BLOCK's request queue, which
+   must be locked. */
+static void
+start_queue (struct block *block) 
+{
+  char name[sizeof block->name + 3];
+
+  ASSERT (lock_held_by_current_thread (&block->queue.lock));
+
+  block->queue.bounce = palloc_get_multiple (0, BOUNCE_PAGES);
+  block->queue.started = true;
+  snprintf (name, sizeof name, "%s-io", block->name);
+  if (thread_create (name, PRI_MAX, serve_queue, block) == TID_ERROR)
+    PANIC ("%s: failed to start request queue", block->name);
+}
+
+/* Returns the request that queue Q, which must be locked and
+   not empty, should serve next: the oldest request if its
+   deadline has passed, otherwise the first at or above the
+   head in C-LOOK order. */
+static struct block_request *
+next_request (struct block_queue *q) 
+{
+  struct block_request *oldest;
+  struct list_elem *e;
+
+  oldest = list_entry (list_front (&q->fifo), struct block_request, fifo_elem);
+  if (timer_ticks () >= oldest->deadline)
+    return oldest;
+
+  for (e = list_begin (&q->sorted); e != list_end (&q->sorted);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request,
+                                            sorted_elem);
+      if (r->sector >= q->head)
+        return r;
+    }
+  return list_entry (list_front (&q->sorted), struct block_request,
+                     sorted_elem);
+}
+
+/* Removes the next request to serve from queue Q, which must be
+   locked and not empty, along with the requests that follow it
+   on disk and can be merged with it into a single command, and
+   moves them in order to BATCH.  Returns the total number of
+   sectors.  Sets *CONTIGUOUS to true if the requests' buffers
+   are adjacent in memory, so that the command can use them
+   directly, or to false if they must go through Q's bounce
+   buffer. */
+static block_sector_t
+take_batch (struct block_queue *q, struct list *batch, bool *contiguous) 
+{
+  struct block_request *r = next_request (q);
+  bool write = r->write;
+  block_sector_t first = r->sector;
+  block_sector_t cnt = 0;
+  uint8_t *next_buffer = r->buffer;
+  struct list_elem *e;
+
+  *contiguous = true;
+  for (;;)
+    {
+      e = list_next (&r->sorted_elem);
+      list_remove (&r->sorted_elem);
+      list_remove (&r->fifo_elem);
+      list_push_back (batch, &r->sorted_elem);
+      cnt += r->cnt;
+      next_buffer = (uint8_t *) r->buffer + r->cnt * BLOCK_SECTOR_SIZE;
+
+      if (e == list_end (&q->sorted))
+        break;
+      r = list_entry (e, struct block_request, sorted_elem);
+      if (r->write != write || r->sector != first + cnt)
+        break;
+      if (!*contiguous || r->buffer != next_buffer)
+        {
+          if (q->bounce == NULL || cnt + r->cnt > BOUNCE_SECTORS)
+            break;
+          *contiguous = false;
+        }
+    }
+
+  q->head = first + cnt;
+  return cnt;
+}
+
+/* Has BLOCK's driver transfer CNT sectors starting at SECTOR
+   between the device and BUFFER, reading if WRITE is false or
+   writing if it is true. */
+static void
+transfer (struct block *block, bool write, block_sector_t sector,
+          block_sector_t cnt, uint8_t *buffer) 
+{
+  const struct block_operations *ops = block->ops;
+  block_sector_t i;
+
+  if (write && ops->write_multiple != NULL)
+    ops->write_multiple (block->aux, sector, cnt, buffer);
+  else if (!write && ops->read_multiple != NULL)
+    ops->read_multiple (block->aux, sector, cnt, buffer);
+  else
+    for (i = 0; i < cnt; i++)
+      {
+        uint8_t *sector_buffer = buffer + i * BLOCK_SECTOR_SIZE;
+        if (write)
+          ops->write (block->aux, sector + i, sector_buffer);
+        else
+          ops->read (block->aux, sector + i, sector_buffer);
+      }
+  block->command_cnt++;
+}
+
+/* Copies data between the requests in BATCH and BOUNCE, which
+   holds their sectors back to back: from the requests to BOUNCE
+   if TO_BOUNCE is true, otherwise the other way. */
+static void
+copy_bounce (struct list *batch, uint8_t *bounce, bool to_bounce) 
+{
+  struct list_elem *e;
+
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request,
+                                            sorted_elem);
+      size_t size = r->cnt * BLOCK_SECTOR_SIZE;
+
+      if (to_bounce)
+        memcpy (bounce, r->buffer, size);
+      else
+        memcpy (r->buffer, bounce, size);
+      bounce += size;
+    }
+}
+
+/* Thread function that serves the request queue of BLOCK_, a
+   struct block with a driver, forever.  Each batch of merged
+   requests becomes one transfer, after which each request in it
+   is completed. */
+static void
+serve_queue (void *block_) 
+{
+  struct block *block = block_;
+  struct block_queue *q = &block->queue;
+
+  for (;;)
+    {
+      struct list batch;
+      struct block_request *first;
+      block_sector_t cnt;
+      bool contiguous;
+
+      list_init (&batch);
+      lock_acquire (&q->lock);
+      while (list_empty (&q->sorted))
+        cond_wait (&q->not_empty, &q->lock);
+      cnt = take_batch (q, &batch, &contiguous);
+      lock_release (&q->lock);
+
+      first = list_entry (list_front (&batch), struct block_request,
+                          sorted_elem);
+      if (contiguous)
+        transfer (block, first->write, first->sector, cnt, first->buffer);
+      else
+        {
+          if (first->write)
+            copy_bounce (&batch, q->bounce, true);
+          transfer (block, first->write, first->sector, cnt, q->bounce);
+          if (!first->write)
+            copy_bounce (&batch, q->bounce, false);
+        }
+
+      while (!list_empty (&batch))
+        {
+          struct block_request *r = list_entry (list_pop_front (&batch),
+                                                struct block_request,
+                                                sorted_elem);
+          block->request_cnt++;
+          if (r->done != NULL)
+            r->done (r);
+          else
+            sema_up (&r->finished);
+        }
+    }
+}
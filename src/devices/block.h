@@ -1,8 +1,11 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,6 +56,52 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, block_sector_t cnt,
+                          void *);
+void block_write_multiple (struct block *, block_sector_t, block_sector_t cnt,
+                           const void *);
+
+/* Asynchronous block requests.
+
+   A request transfers CNT consecutive sectors starting at SECTOR
+   between the block device and BUFFER.  Submitting one with
+   block_submit() queues it and returns at once.  Each physical
+   device has a service thread that reorders pending requests in
+   C-LOOK order, sweeping upward from the last sector served and
+   then jumping back to the lowest, except that a request pending
+   for longer than a deadline is served first so that none
+   starves.  Requests for adjacent sectors in the same direction
+   are merged into one driver command.
+
+   Pending requests for overlapping sectors may be served in any
+   order, so a caller that cares about their order must wait for
+   one before submitting the other. */
+struct block_request;
+typedef void block_done_func (struct block_request *);
+
+struct block_request
+  {
+    /* Set by the submitter. */
+    bool write;                 /* True to write, false to read. */
+    block_sector_t sector;      /* First sector. */
+    block_sector_t cnt;         /* Number of sectors, at least 1. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    block_done_func *done;      /* Called on completion, or null. */
+    void *aux;                  /* For use by DONE. */
+
+    /* Owned by the block layer. */
+    struct list_elem sorted_elem;       /* In queue's sector order. */
+    struct list_elem fifo_elem;         /* In queue's arrival order. */
+    int64_t deadline;                   /* Serve by this timer tick. */
+    struct semaphore finished;          /* Up'd on completion. */
+  };
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t, block_sector_t cnt, void *buffer,
+                         block_done_func *, void *aux);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
@@ -61,10 +110,25 @@ void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
 
+/* Driver operations.  READ_MULTIPLE and WRITE_MULTIPLE transfer
+   CNT consecutive sectors; a driver that cannot do better than
+   one sector at a time may leave them null.
+
+   A device that is only a window onto another one, such as a
+   partition, instead provides REMAP, which translates *SECTOR
+   into a sector on the underlying device and returns that
+   device.  Its requests then join the underlying device's
+   queue, so that they are scheduled together with every other
+   request for the same disk. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+    void (*read_multiple) (void *aux, block_sector_t, block_sector_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, block_sector_t cnt,
+                            const void *buffer);
+    struct block *(*remap) (void *aux, block_sector_t *sector);
   };
 
 struct block *block_register (const char *name, enum block_type,
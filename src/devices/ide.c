@@ -5,13 +5,23 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   By default all data moves through the data register by
+   programmed I/O (PIO), which keeps the CPU copying every byte.
+   With the -dma option, disks on a PCI IDE controller with
+   bus-master DMA support, such as the PIIX3 and PIIX4 that
+   QEMU and Bochs emulate, instead transfer data straight to
+   and from memory while the requesting thread sleeps.  Any
+   transfer that DMA cannot handle falls back to PIO. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -30,10 +40,25 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus master IDE port addresses.  See [PIIX] 2.7. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits.
+   The error and interrupt bits are cleared by writing 1s. */
+#define BM_STA_ERR 0x02         /* Transfer failed. */
+#define BM_STA_INTR 0x04        /* Device raised its interrupt. */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +74,38 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Most sectors that one read or write command can transfer.
+   A sector count register value of 0 stands for this many. */
+#define COMMAND_SECTORS_MAX 256
+
+/* Longest time to wait for a command completion interrupt, in
+   timer ticks.  [ATA-3] allows a device up to 30 seconds. */
+#define COMPLETION_TIMEOUT (30 * TIMER_FREQ)
+
+/* A physical region descriptor, which tells the bus master
+   where in memory to move part of a DMA transfer.  A region
+   must not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address, even. */
+    uint16_t size;              /* Byte count, with 0 meaning 64 kB. */
+    uint16_t flags;             /* PRD_EOT or 0. */
+  };
+
+/* PRD flags. */
+#define PRD_EOT 0x8000          /* Last region in table. */
+
+/* Number of PRDs per channel.  A single command transfers at
+   most COMMAND_SECTORS_MAX sectors (128 kB) from physically
+   contiguous kernel memory, which crosses at most two 64 kB
+   boundaries, so 3 would do. */
+#define PRD_CNT 4
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +114,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int block_sectors;          /* Sectors per interrupt in multiple
+                                   mode, or 1 if not in multiple mode. */
+    bool dma;                   /* Transfer data by DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -72,6 +132,10 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus master I/O port, 0 if no DMA. */
+    struct prd prdt[PRD_CNT]    /* Table for the current DMA transfer. */
+      __attribute__ ((aligned (sizeof (struct prd) * PRD_CNT)));
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -79,16 +143,29 @@ struct channel
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/* -dma: Use bus-master DMA instead of programmed I/O? */
+bool ide_dma;
+
 static struct block_operations ide_operations;
 
+static uint16_t find_bus_master (void);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
+static void set_multiple_mode (struct ata_disk *, int max_sectors);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void read_pio (struct ata_disk *, block_sector_t, size_t cnt, void *);
+static void write_pio (struct ata_disk *, block_sector_t, size_t cnt,
+                       const void *);
+static bool can_dma (const struct ata_disk *, const void *);
+static bool transfer_dma (struct ata_disk *, block_sector_t, size_t cnt,
+                          void *, bool write);
+
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
-static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
+static bool wait_for_completion (const struct ata_disk *);
+static void input_sectors (struct channel *, void *, size_t cnt);
+static void output_sectors (struct channel *, const void *, size_t cnt);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -101,6 +178,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  uint16_t bm_base = ide_dma ? find_bus_master () : 0;
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -126,6 +204,7 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +215,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->block_sectors = 1;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -159,6 +240,44 @@ ide_init (void)
 
 static char *descramble_ata_string (char *, int size);
 
+/* Looks for a PCI IDE controller that can act as a bus master
+   with its channels at the legacy ports we use.  If one is
+   found, enables its bus mastering and returns the I/O port of
+   its bus master registers for channel 0 (channel 1's follow 8
+   ports later); otherwise, returns 0. */
+static uint16_t
+find_bus_master (void) 
+{
+  struct pci_addr a;
+  uint32_t class_reg, bar;
+  uint8_t prog_if;
+
+  if (!pci_find_class (0x01, 0x01, &a))
+    {
+      printf ("ide: no PCI IDE controller, using PIO\n");
+      return 0;
+    }
+
+  /* Programming interface bit 7 says whether the controller can
+     be a bus master.  Bits 0 and 2 are set if channel 0 or 1 is
+     in native mode, at ports other than the legacy ones. */
+  class_reg = pci_read_config (&a, PCI_REG_CLASS);
+  prog_if = class_reg >> 8;
+  bar = pci_read_config (&a, PCI_REG_BAR4);
+  if (!(prog_if & 0x80) || (prog_if & 0x05) || !(bar & 1))
+    {
+      printf ("ide: controller %02x:%02x.%x cannot do DMA, using PIO\n",
+              a.bus, a.dev, a.func);
+      return 0;
+    }
+
+  pci_write_config (&a, PCI_REG_COMMAND,
+                    (pci_read_config (&a, PCI_REG_COMMAND) & 0xffff)
+                    | PCI_CMD_IO | PCI_CMD_BUS_MASTER);
+  printf ("ide: bus-master DMA at port 0x%04"PRIx32"\n", bar & 0xfffc);
+  return bar & 0xfffc;
+}
+
 /* Resets an ATA channel and waits for any devices present on it
    to finish the reset. */
 static void
@@ -273,13 +392,19 @@ identify_ata_device (struct ata_disk *d)
      into our buffer. */
   select_device_wait (d);
   issue_pio_command (c, CMD_IDENTIFY_DEVICE);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
+  if (!wait_for_completion (d) || !wait_while_busy (d))
     {
       d->is_ata = false;
       return;
     }
-  input_sector (c, id);
+  input_sectors (c, id, 1);
+
+  /* Transfer as many sectors per interrupt as the disk allows.
+     Use DMA if the disk supports it (word 49, bit 8) and the
+     channel has a bus master.  We rely on the BIOS or emulator
+     to have selected a DMA transfer mode. */
+  set_multiple_mode (d, (uint8_t) id[47 * 2]);
+  d->dma = c->bm_base != 0 && (id[49 * 2 + 1] & 0x01) != 0;
 
   /* Calculate capacity.
      Read model name and serial number. */
@@ -287,7 +412,8 @@ identify_ata_device (struct ata_disk *d)
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
   snprintf (extra_info, sizeof extra_info,
-            "model \"%s\", serial \"%s\"", model, serial);
+            "model \"%s\", serial \"%s\"%s", model, serial,
+            d->dma ? ", DMA" : "");
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
@@ -337,63 +463,285 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Puts disk D into multiple mode with the largest power of 2
+   sectors per interrupt that does not exceed MAX_SECTORS, the
+   maximum reported by IDENTIFY DEVICE.  Leaves D transferring
+   one sector per interrupt if that is the most it supports or
+   if the command fails. */
+static void
+set_multiple_mode (struct ata_disk *d, int max_sectors) 
+{
+  struct channel *c = d->channel;
+  int block_sectors = 1;
+
+  while (block_sectors * 2 <= max_sectors)
+    block_sectors *= 2;
+  if (block_sectors <= 1)
+    return;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), block_sectors);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  if (wait_for_completion (d) && !(inb (reg_status (c)) & STA_ERR))
+    d->block_sectors = block_sectors;
+}
+
+/* Reads the CNT sectors starting at SEC_NO from disk D into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Issues one command per COMMAND_SECTORS_MAX sectors,
+   each one a DMA transfer if possible and otherwise PIO.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multiple (void *d_, block_sector_t sec_no, block_sector_t cnt,
+                   void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      size_t sector_cnt = cnt < COMMAND_SECTORS_MAX ? cnt : COMMAND_SECTORS_MAX;
+
+      if (!can_dma (d, buffer)
+          || !transfer_dma (d, sec_no, sector_cnt, buffer, false))
+        read_pio (d, sec_no, sector_cnt, buffer);
+
+      buffer += sector_cnt * BLOCK_SECTOR_SIZE;
+      sec_no += sector_cnt;
+      cnt -= sector_cnt;
+    }
   lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes the CNT sectors starting at SEC_NO to disk D from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the disk has acknowledged receiving the data.
+   Issues commands as ide_read_multiple() does.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multiple (void *d_, block_sector_t sec_no, block_sector_t cnt,
+                    const void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      size_t sector_cnt = cnt < COMMAND_SECTORS_MAX ? cnt : COMMAND_SECTORS_MAX;
+
+      if (!can_dma (d, buffer)
+          || !transfer_dma (d, sec_no, sector_cnt, (void *) buffer, true))
+        write_pio (d, sec_no, sector_cnt, buffer);
+
+      buffer += sector_cnt * BLOCK_SECTOR_SIZE;
+      sec_no += sector_cnt;
+      cnt -= sector_cnt;
+    }
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ide_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multiple (d, sec_no, 1, buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data. */
+static void
+ide_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d, sec_no, 1, buffer);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    NULL
   };
-
+
+/* Programmed I/O and DMA transfers. */
+
+/* Reads CNT sectors, between 1 and COMMAND_SECTORS_MAX, starting
+   at SEC_NO from disk D into BUFFER with a single PIO command,
+   using READ MULTIPLE if the disk is in multiple mode, so that
+   it interrupts once per block of sectors rather than once per
+   sector.  D's channel must be locked. */
+static void
+read_pio (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+          void *buffer_)
+{
+  struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+  size_t done, chunk;
+
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, (d->block_sectors > 1
+                         ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY));
+  for (done = 0; done < cnt; done += chunk)
+    {
+      chunk = cnt - done;
+      if (chunk > (size_t) d->block_sectors)
+        chunk = d->block_sectors;
+      if (!wait_for_completion (d) || !wait_while_busy (d))
+        PANIC ("%s: disk read failed, sector=%"PRDSNu,
+               d->name, sec_no + done);
+      input_sectors (c, buffer, chunk);
+      buffer += chunk * BLOCK_SECTOR_SIZE;
+    }
+}
+
+/* Writes CNT sectors, between 1 and COMMAND_SECTORS_MAX,
+   starting at SEC_NO to disk D from BUFFER with a single PIO
+   command, as read_pio() does.  D's channel must be locked. */
+static void
+write_pio (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+           const void *buffer_)
+{
+  struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+  size_t done, chunk;
+
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, (d->block_sectors > 1
+                         ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY));
+  for (done = 0; done < cnt; done += chunk)
+    {
+      /* The disk asks for the first block right away and
+         interrupts before asking for each later one. */
+      chunk = cnt - done;
+      if (chunk > (size_t) d->block_sectors)
+        chunk = d->block_sectors;
+      if ((done > 0 && !wait_for_completion (d)) || !wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu,
+               d->name, sec_no + done);
+      output_sectors (c, buffer, chunk);
+      buffer += chunk * BLOCK_SECTOR_SIZE;
+    }
+
+  /* It interrupts once more when the last block is written. */
+  if (!wait_for_completion (d))
+    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
+}
+
+/* Returns true if disk D can move data to or from BUFFER by
+   DMA.  The bus master needs a physical address, so BUFFER must
+   be in kernel memory, where physical memory is mapped
+   contiguously; user buffers go through PIO.  PRD addresses
+   must also be even. */
+static bool
+can_dma (const struct ata_disk *d, const void *buffer) 
+{
+  return d->dma && is_kernel_vaddr (buffer) && (uintptr_t) buffer % 2 == 0;
+}
+
+/* Fills in the PRD table of channel C to describe the SIZE
+   bytes of kernel memory at BUFFER. */
+static void
+build_prdt (struct channel *c, const void *buffer, size_t size) 
+{
+  uint32_t addr = vtop (buffer);
+  struct prd *prd;
+
+  ASSERT (size > 0);
+  for (prd = c->prdt; ; prd++)
+    {
+      size_t chunk = 0x10000 - (addr & 0xffff);
+      if (chunk > size)
+        chunk = size;
+
+      ASSERT (prd < c->prdt + PRD_CNT);
+      prd->addr = addr;
+      prd->size = chunk & 0xffff;
+      prd->flags = 0;
+
+      addr += chunk;
+      size -= chunk;
+      if (size == 0)
+        break;
+    }
+  prd->flags = PRD_EOT;
+}
+
+/* Transfers CNT sectors, between 1 and COMMAND_SECTORS_MAX,
+   starting at SEC_NO between disk D and BUFFER by bus-master
+   DMA, reading from the disk into BUFFER if WRITE is false or
+   writing BUFFER to the disk if it is true.  The calling thread
+   sleeps until the disk interrupts at the end of the transfer.
+   D's channel must be locked and can_dma(D, BUFFER) must be
+   true.
+
+   Returns true if successful.  On failure, turns off DMA for D
+   and returns false, so that the caller can retry with PIO. */
+static bool
+transfer_dma (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              void *buffer, bool write) 
+{
+  struct channel *c = d->channel;
+  uint8_t direction = write ? 0 : BM_CMD_READ;
+  uint8_t bm_status;
+  bool completed;
+
+  ASSERT (can_dma (d, buffer));
+
+  /* Point the bus master at the buffer and clear any stale
+     error and interrupt status. */
+  build_prdt (c, buffer, cnt * BLOCK_SECTOR_SIZE);
+  barrier ();
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c), inb (reg_bm_status (c)) | BM_STA_ERR | BM_STA_INTR);
+
+  /* Start the command on the disk, then the bus master. */
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), direction | BM_CMD_START);
+
+  /* Sleep until the disk interrupts, then stop the bus master
+     and check how things went. */
+  completed = wait_for_completion (d);
+  outb (reg_bm_command (c), direction);
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), bm_status | BM_STA_ERR | BM_STA_INTR);
+  barrier ();
+
+  if (!completed || (bm_status & BM_STA_ERR)
+      || (inb (reg_status (c)) & STA_ERR))
+    {
+      printf ("%s: DMA %s failed, sector=%"PRDSNu"; switching to PIO\n",
+              d->name, write ? "write" : "read", sec_no);
+      d->dma = false;
+      return false;
+    }
+  return true;
+}
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT, which must be between 1 and
+   COMMAND_SECTORS_MAX, to the disk's sector selection
+   registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= COMMAND_SECTORS_MAX);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == COMMAND_SECTORS_MAX ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -402,7 +750,8 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 }
 
 /* Writes COMMAND to channel C and prepares for receiving a
-   completion interrupt. */
+   completion interrupt.  Despite the name, also used to start
+   DMA commands, which complete the same way. */
 static void
 issue_pio_command (struct channel *c, uint8_t command) 
 {
@@ -414,20 +763,46 @@ issue_pio_command (struct channel *c, uint8_t command)
   outb (reg_command (c), command);
 }
 
-/* Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
+/* Waits for the completion interrupt for the command last issued
+   to disk D, giving up after COMPLETION_TIMEOUT ticks.  Returns
+   true if the interrupt arrived, false on timeout. */
+static bool
+wait_for_completion (const struct ata_disk *d) 
+{
+  struct channel *c = d->channel;
+  enum intr_level old_level;
+
+  if (sema_down_timeout (&c->completion_wait, COMPLETION_TIMEOUT))
+    return true;
+
+  /* Stop expecting the interrupt, and discard it in case it
+     arrived just after we gave up, so that it cannot be mistaken
+     for the completion of the next command. */
+  old_level = intr_disable ();
+  c->expecting_interrupt = false;
+  sema_try_down (&c->completion_wait);
+  intr_set_level (old_level);
+
+  printf ("%s: command timeout\n", d->name);
+  return false;
+}
+
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-input_sector (struct channel *c, void *sector) 
+input_sectors (struct channel *c, void *sectors, size_t cnt) 
 {
-  insw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  insw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
+/* Writes CNT sectors from SECTORS to channel C's data register
+   in PIO mode.  SECTORS must contain CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-output_sector (struct channel *c, const void *sector) 
+output_sectors (struct channel *c, const void *sectors, size_t cnt) 
 {
-  outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  outsw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
 /* Low-level ATA primitives. */
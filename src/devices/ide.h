@@ -1,6 +1,11 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
+#include <stdbool.h>
+
+/* -dma: Use bus-master DMA instead of programmed I/O? */
+extern bool ide_dma;
+
 void ide_init (void);
 
 #endif /* devices/ide.h */
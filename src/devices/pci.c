@@ -0,0 +1,96 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/interrupt.h"
+#include "threads/io.h"
+
+/* Minimal access to PCI configuration space through
+   configuration mechanism #1, which every PC since the PCI bus
+   was introduced (and every emulator) supports.  See [PCI] 3.2.2.3.2.
+
+   Just enough to find a device by class and to read and write
+   its configuration registers; there is no general support for
+   enumerating buses or assigning resources, which the BIOS has
+   already done. */
+
+/* Configuration mechanism #1 I/O ports. */
+#define PCI_CONFIG_ADDR 0xcf8   /* Selects a configuration register. */
+#define PCI_CONFIG_DATA 0xcfc   /* Reads or writes the selected register. */
+
+/* Returns the value to write to PCI_CONFIG_ADDR to select
+   register REG, which must be dword-aligned, of function A. */
+static uint32_t
+config_address (const struct pci_addr *a, int reg) 
+{
+  ASSERT (a->dev < 32 && a->func < 8);
+  ASSERT (reg >= 0 && reg < 256 && reg % 4 == 0);
+
+  return (0x80000000 | ((uint32_t) a->bus << 16)
+          | ((uint32_t) a->dev << 11) | ((uint32_t) a->func << 8) | reg);
+}
+
+/* Reads configuration register REG, a dword-aligned byte offset,
+   of function A. */
+uint32_t
+pci_read_config (const struct pci_addr *a, int reg) 
+{
+  enum intr_level old_level = intr_disable ();
+  uint32_t value;
+
+  outl (PCI_CONFIG_ADDR, config_address (a, reg));
+  value = inl (PCI_CONFIG_DATA);
+  intr_set_level (old_level);
+
+  return value;
+}
+
+/* Writes VALUE to configuration register REG, a dword-aligned
+   byte offset, of function A. */
+void
+pci_write_config (const struct pci_addr *a, int reg, uint32_t value) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  outl (PCI_CONFIG_ADDR, config_address (a, reg));
+  outl (PCI_CONFIG_DATA, value);
+  intr_set_level (old_level);
+}
+
+/* Searches every bus for the first function whose class code is
+   CLASS and whose subclass is SUBCLASS.  If one is found, stores
+   its location in *A and returns true; otherwise, returns
+   false. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_addr *a) 
+{
+  int bus, dev, func;
+
+  for (bus = 0; bus < 256; bus++)
+    for (dev = 0; dev < 32; dev++)
+      for (func = 0; func < 8; func++)
+        {
+          uint32_t class_reg;
+
+          a->bus = bus;
+          a->dev = dev;
+          a->func = func;
+          if ((pci_read_config (a, PCI_REG_ID) & 0xffff) == 0xffff)
+            {
+              /* No function here.  If function 0 is missing, so
+                 is the whole device. */
+              if (func == 0)
+                break;
+              continue;
+            }
+
+          class_reg = pci_read_config (a, PCI_REG_CLASS);
+          if ((class_reg >> 24) == class
+              && ((class_reg >> 16) & 0xff) == subclass)
+            return true;
+
+          /* Only multifunction devices have functions past 0. */
+          if (func == 0
+              && !(pci_read_config (a, PCI_REG_HEADER) & 0x00800000))
+            break;
+        }
+  return false;
+}
@@ -0,0 +1,205 @@
+#include "devices/timeout.h"
+#include <debug.h>
+#include "threads/interrupt.h"
+
+/* The timing wheel has WHEEL_LEVELS levels of WHEEL_SLOTS slots
+   each.  Level 0 has one slot per tick.  Each slot in level N
+   spans all of level N - 1, that is, WHEEL_SLOTS**N ticks.
+
+   A timeout due within WHEEL_SLOTS ticks goes straight into the
+   level 0 slot for its deadline.  Timeouts further out go into a
+   coarser slot, and are "cascaded" down to the next finer level
+   when the level 0 index wraps around to that slot.  Each
+   timeout is therefore moved at most WHEEL_LEVELS - 1 times
+   before it expires, and each tick only touches the level 0
+   slot for the current tick plus, once every WHEEL_SLOTS ticks,
+   one slot per coarser level.
+
+   Four levels of 64 slots cover 2**24 ticks, about 46 hours at
+   100 Hz.  Timeouts beyond that are parked in the last slot of
+   the top level and re-filed each time they are cascaded. */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+
+/* The wheel itself. */
+static struct list wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+
+/* Next tick to be processed by timeout_run().  Every pending
+   timeout with deadline < clock has already expired. */
+static int64_t clock;
+
+static void enqueue (struct timeout *);
+static void cascade (int level);
+
+/* Initializes the timing wheel.  NOW is the current timer tick,
+   which becomes the first tick to be processed. */
+void
+timeout_wheel_init (int64_t now) 
+{
+  int level, slot;
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SLOTS; slot++)
+      list_init (&wheel[level][slot]);
+  clock = now;
+}
+
+/* Expires every timeout whose deadline is at or before NOW.
+   Called by the timer interrupt handler on each tick. */
+void
+timeout_run (int64_t now) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (clock <= now)
+    {
+      int index = clock & WHEEL_MASK;
+      struct list expired;
+
+      /* When level 0 wraps, refill it from level 1, and so on up
+         the hierarchy for each level that also wraps. */
+      if (index == 0)
+        {
+          int level;
+          for (level = 1; level < WHEEL_LEVELS; level++)
+            {
+              cascade (level);
+              if (((clock >> (level * WHEEL_BITS)) & WHEEL_MASK) != 0)
+                break;
+            }
+        }
+
+      /* Detach the slot before running anything, and advance the
+         clock first, so that a timeout function re-adding its
+         own timeout for this tick lands in the next slot
+         rather than in the one being emptied. */
+      list_init (&expired);
+      if (!list_empty (&wheel[0][index]))
+        list_splice (list_begin (&expired),
+                     list_begin (&wheel[0][index]),
+                     list_end (&wheel[0][index]));
+      clock++;
+
+      while (!list_empty (&expired))
+        {
+          struct timeout *t = list_entry (list_pop_front (&expired),
+                                          struct timeout, elem);
+          t->pending = false;
+          t->func (t->aux);
+        }
+    }
+}
+
+/* Initializes timeout T to call FUNC with AUX when it expires.
+   T is not pending until it is added with timeout_add(). */
+void
+timeout_init (struct timeout *t, timeout_func *func, void *aux) 
+{
+  ASSERT (t != NULL);
+  ASSERT (func != NULL);
+
+  t->func = func;
+  t->aux = aux;
+  t->deadline = 0;
+  t->pending = false;
+}
+
+/* Arranges for T to expire at timer tick DEADLINE, or on the
+   next tick if DEADLINE has already passed.  If T is already
+   pending, it is rescheduled. */
+void
+timeout_add (struct timeout *t, int64_t deadline) 
+{
+  enum intr_level old_level;
+
+  ASSERT (t != NULL);
+
+  old_level = intr_disable ();
+  if (t->pending)
+    list_remove (&t->elem);
+  t->deadline = deadline;
+  t->pending = true;
+  enqueue (t);
+  intr_set_level (old_level);
+}
+
+/* Cancels T.  Returns true if T was pending, false if it had
+   already expired or was never added. */
+bool
+timeout_cancel (struct timeout *t) 
+{
+  enum intr_level old_level;
+  bool was_pending;
+
+  ASSERT (t != NULL);
+
+  old_level = intr_disable ();
+  was_pending = t->pending;
+  if (was_pending)
+    {
+      list_remove (&t->elem);
+      t->pending = false;
+    }
+  intr_set_level (old_level);
+
+  return was_pending;
+}
+
+/* Returns true if T has been added and has not yet expired or
+   been cancelled. */
+bool
+timeout_pending (const struct timeout *t) 
+{
+  return t->pending;
+}
+
+/* Files T into the wheel slot for its deadline, relative to the
+   current clock.  Interrupts must be off. */
+static void
+enqueue (struct timeout *t) 
+{
+  int64_t delta = t->deadline - clock;
+  int64_t expires = t->deadline;
+  int level;
+
+  if (delta < 0)
+    {
+      /* Already due: expire on the next tick processed. */
+      list_push_back (&wheel[0][clock & WHEEL_MASK], &t->elem);
+      return;
+    }
+
+  /* Too far out for the wheel: park it at the outermost slot.
+     It will be re-filed when that slot is cascaded. */
+  if (delta >= (int64_t) 1 << (WHEEL_LEVELS * WHEEL_BITS))
+    {
+      delta = ((int64_t) 1 << (WHEEL_LEVELS * WHEEL_BITS)) - 1;
+      expires = clock + delta;
+    }
+
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (delta < (int64_t) 1 << ((level + 1) * WHEEL_BITS))
+      break;
+  list_push_back (&wheel[level][(expires >> (level * WHEEL_BITS))
+                                & WHEEL_MASK],
+                  &t->elem);
+}
+
+/* Moves every timeout in the LEVEL slot for the current clock
+   down to finer levels. */
+static void
+cascade (int level) 
+{
+  int index = (clock >> (level * WHEEL_BITS)) & WHEEL_MASK;
+  struct list *slot = &wheel[level][index];
+  struct list moving;
+
+  list_init (&moving);
+  if (list_empty (slot))
+    return;
+  list_splice (list_begin (&moving), list_begin (slot), list_end (slot));
+  while (!list_empty (&moving))
+    enqueue (list_entry (list_pop_front (&moving), struct timeout, elem));
+}
@@ -0,0 +1,45 @@
+#ifndef DEVICES_TIMEOUT_H
+#define DEVICES_TIMEOUT_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Kernel timeouts.
+
+   A timeout calls a function once the timer tick count reaches a
+   given deadline.  Pending timeouts are kept in a hashed
+   hierarchical timing wheel driven by the timer interrupt, so
+   that adding, cancelling, and expiring a timeout all take
+   constant time regardless of how many are pending.
+
+   Timeout functions run in the timer interrupt handler, with
+   interrupts off.  They must not sleep, but they may call
+   thread_unblock(), sema_up(), or timeout_add().
+
+   The functions below may be called from kernel threads or from
+   interrupt handlers. */
+
+/* Function called when a timeout expires, given the auxiliary
+   data passed to timeout_init(). */
+typedef void timeout_func (void *aux);
+
+/* A timeout. */
+struct timeout
+  {
+    struct list_elem elem;      /* Element in a wheel slot. */
+    int64_t deadline;           /* Tick at which to expire. */
+    timeout_func *func;         /* Function to call. */
+    void *aux;                  /* Auxiliary data for FUNC. */
+    bool pending;               /* True while in the wheel. */
+  };
+
+void timeout_wheel_init (int64_t now);
+void timeout_run (int64_t now);
+
+void timeout_init (struct timeout *, timeout_func *, void *aux);
+void timeout_add (struct timeout *, int64_t deadline);
+bool timeout_cancel (struct timeout *);
+bool timeout_pending (const struct timeout *);
+
+#endif /* devices/timeout.h */
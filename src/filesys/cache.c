@@ -0,0 +1,524 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Buffer cache of file system sectors.
+
+   Every sector the file system reads or writes passes through
+   one of CACHE_CNT cache blocks.  A thread locks the block for a
+   sector with cache_lock(), shared to read it or exclusive to
+   modify it, and unlocks it with cache_unlock().  A locked block
+   stays in the cache; unlocked blocks are evicted in clock
+   (second chance) order when a sector that is not cached is
+   needed.
+
+   Modified blocks are written back when they are evicted, by a
+   write-behind thread every WRITE_BEHIND_INTERVAL ticks, and by
+   cache_flush() when the file system shuts down.  A read-ahead
+   thread loads sectors that the file system expects to need
+   soon, so that sequential reads find them already cached. */
+
+/* Number of cache blocks. */
+#define CACHE_CNT 64
+
+/* Timer ticks between write-behind passes. */
+#define WRITE_BEHIND_INTERVAL (5 * TIMER_FREQ)
+
+/* Most sectors waiting for read-ahead.  Requests beyond this are
+   dropped. */
+#define READAHEAD_MAX 16
+
+/* Marks a cache block that holds no sector. */
+#define INVALID_SECTOR ((block_sector_t) -1)
+
+/* A cache block. */
+struct cache_block
+  {
+    /* Protected by cache_sync. */
+    block_sector_t sector;      /* Sector held, or INVALID_SECTOR. */
+    int users;                  /* Threads holding or waiting for RW. */
+    bool dirty;                 /* Modified since last written? */
+
+    bool accessed;              /* Used since the clock hand passed? */
+    struct rwlock rw;           /* Shared or exclusive access to DATA. */
+    struct lock data_lock;      /* Serializes loading DATA. */
+    bool up_to_date;            /* DATA holds the sector's contents? */
+    struct block_request request;       /* For write-behind. */
+    uint8_t *data;              /* BLOCK_SECTOR_SIZE bytes. */
+  };
+
+/* Cache blocks. */
+static struct cache_block cache[CACHE_CNT];
+
+/* Protects each block's SECTOR, USERS and DIRTY members, the
+   clock hand, and the statistics. */
+static struct lock cache_sync;
+
+/* Signaled when a block's USERS drops to 0. */
+static struct condition block_released;
+
+/* Clock hand for eviction. */
+static int hand;
+
+/* Sectors waiting for read-ahead, in a circular buffer. */
+static struct lock readahead_lock;
+static struct condition readahead_ready;
+static block_sector_t readahead_sectors[READAHEAD_MAX];
+static size_t readahead_head, readahead_cnt;
+
+/* Statistics. */
+static long long hit_cnt, miss_cnt;     /* Lookups found or not. */
+static long long write_cnt;             /* Sectors written back. */
+static long long readahead_cnt_total;   /* Read-ahead requests queued. */
+
+static struct cache_block *get_block (block_sector_t, bool wait);
+static struct cache_block *lookup (block_sector_t);
+static struct cache_block *choose_victim (void);
+static void release (struct cache_block *);
+static thread_func write_behind_daemon NO_RETURN;
+static thread_func readahead_daemon NO_RETURN;
+
+/* Initializes the buffer cache and starts its threads. */
+void
+cache_init (void)
+{
+  uint8_t *data;
+  size_t i;
+
+  data = palloc_get_multiple (PAL_ASSERT,
+                              CACHE_CNT * BLOCK_SECTOR_SIZE / PGSIZE);
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_block *b = &cache[i];
+      b->sector = INVALID_SECTOR;
+      b->users = 0;
+      b->dirty = false;
+      b->accessed = false;
+      rwlock_init (&b->rw);
+      lock_init (&b->data_lock);
+      b->up_to_date = false;
+      b->data = data + i * BLOCK_SECTOR_SIZE;
+    }
+  lock_init (&cache_sync);
+  cond_init (&block_released);
+  lock_init (&readahead_lock);
+  cond_init (&readahead_ready);
+
+  thread_create ("write-behind", PRI_DEFAULT, write_behind_daemon, NULL);
+  thread_create ("read-ahead", PRI_DEFAULT, readahead_daemon, NULL);
+}
+
+/* Writes every modified cache block to disk.
+
+   Blocks that can be locked without waiting are written with
+   one request apiece, all submitted before any is waited for, so
+   that the block layer can sort and merge them.  Blocks that are
+   busy are written afterward, one at a time, so that this
+   function never holds one block while waiting for another. */
+void
+cache_flush (void)
+{
+  struct cache_block *busy[CACHE_CNT];
+  struct cache_block *submitted[CACHE_CNT];
+  size_t busy_cnt = 0, submitted_cnt = 0;
+  size_t i;
+
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_block *b = &cache[i];
+
+      lock_acquire (&cache_sync);
+      if (b->sector == INVALID_SECTOR || !b->dirty)
+        {
+          lock_release (&cache_sync);
+          continue;
+        }
+      b->users++;
+      lock_release (&cache_sync);
+
+      if (!rwlock_try_acquire_read (&b->rw))
+        {
+          busy[busy_cnt++] = b;
+          continue;
+        }
+
+      lock_acquire (&cache_sync);
+      if (b->dirty)
+        {
+          b->dirty = false;
+          write_cnt++;
+          lock_release (&cache_sync);
+          block_request_init (&b->request, true, b->sector, 1, b->data,
+                              NULL, NULL);
+          block_submit (fs_device, &b->request);
+          submitted[submitted_cnt++] = b;
+        }
+      else
+        {
+          lock_release (&cache_sync);
+          rwlock_release_read (&b->rw);
+          release (b);
+        }
+    }
+
+  for (i = 0; i < submitted_cnt; i++)
+    {
+      struct cache_block *b = submitted[i];
+      block_wait (&b->request);
+      rwlock_release_read (&b->rw);
+      release (b);
+    }
+
+  for (i = 0; i < busy_cnt; i++)
+    {
+      struct cache_block *b = busy[i];
+      bool dirty;
+
+      rwlock_acquire_read (&b->rw);
+      lock_acquire (&cache_sync);
+      dirty = b->dirty;
+      b->dirty = false;
+      if (dirty)
+        write_cnt++;
+      lock_release (&cache_sync);
+      if (dirty)
+        block_write (fs_device, b->sector, b->data);
+      rwlock_release_read (&b->rw);
+      release (b);
+    }
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Cache: %lld hits, %lld misses, %lld write-backs, "
+          "%lld read-aheads\n",
+          hit_cnt, miss_cnt, write_cnt, readahead_cnt_total);
+}
+
+/* Locks the cache block for SECTOR, loading it into the cache if
+   necessary, and returns it.  TYPE is CACHE_SHARED to read the
+   block's data or CACHE_EXCLUSIVE to modify it.  The block's
+   data is not read from disk until cache_read() is called.
+
+   This function may sleep. */
+struct cache_block *
+cache_lock (block_sector_t sector, enum cache_lock_type type)
+{
+  struct cache_block *b = get_block (sector, true);
+
+  if (type == CACHE_EXCLUSIVE)
+    rwlock_acquire_write (&b->rw);
+  else
+    rwlock_acquire_read (&b->rw);
+  b->accessed = true;
+  return b;
+}
+
+/* Returns the cache block for SECTOR, assigning one to it if
+   necessary, and marks it in use by the current thread so that
+   it cannot be evicted.  The caller must lock it, or give up its
+   use with release().
+
+   If WAIT is true, this function may sleep until a block comes
+   free.  If WAIT is false, it never waits for another thread:
+   it returns a null pointer instead if SECTOR is not cached and
+   no clean block is free to take over. */
+static struct cache_block *
+get_block (block_sector_t sector, bool wait)
+{
+  struct cache_block *b;
+
+  ASSERT (sector != INVALID_SECTOR);
+
+  lock_acquire (&cache_sync);
+  for (;;)
+    {
+      b = lookup (sector);
+      if (b != NULL)
+        {
+          hit_cnt++;
+          break;
+        }
+
+      b = choose_victim ();
+      if (!wait && (b == NULL || b->dirty))
+        {
+          /* Writing back a dirty victim would mean waiting for
+             whoever locks its sector meanwhile. */
+          lock_release (&cache_sync);
+          return NULL;
+        }
+      if (b == NULL)
+        {
+          /* Every block is in use.  Wait for one to come free. */
+          cond_wait (&block_released, &cache_sync);
+          continue;
+        }
+
+      if (!b->dirty)
+        {
+          /* Take over the clean victim for SECTOR.  No one else
+             is using it, so it is safe to mark its data stale
+             without holding RW. */
+          miss_cnt++;
+          b->sector = sector;
+          b->up_to_date = false;
+          break;
+        }
+
+      /* Write back the dirty victim, then look again from the
+         start, because SECTOR may have been loaded meanwhile and
+         someone may have started using the victim's sector. */
+      b->users++;
+      b->dirty = false;
+      write_cnt++;
+      lock_release (&cache_sync);
+      rwlock_acquire_read (&b->rw);
+      block_write (fs_device, b->sector, b->data);
+      rwlock_release_read (&b->rw);
+      lock_acquire (&cache_sync);
+      if (--b->users == 0)
+        cond_signal (&block_released, &cache_sync);
+    }
+  b->users++;
+  lock_release (&cache_sync);
+
+  return b;
+}
+
+/* Returns the data in locked block B, reading it from disk
+   first if it is not already in memory. */
+void *
+cache_read (struct cache_block *b)
+{
+  lock_acquire (&b->data_lock);
+  if (!b->up_to_date)
+    {
+      block_read (fs_device, b->sector, b->data);
+      b->up_to_date = true;
+    }
+  lock_release (&b->data_lock);
+
+  return b->data;
+}
+
+/* Fills block B, which must be locked exclusively, with zeros,
+   marks it dirty, and returns its data.  Avoids reading B's
+   sector from disk when it is about to be overwritten anyway. */
+void *
+cache_zero (struct cache_block *b)
+{
+  ASSERT (b->rw.writer);
+
+  memset (b->data, 0, BLOCK_SECTOR_SIZE);
+  b->up_to_date = true;
+  b->dirty = true;
+
+  return b->data;
+}
+
+/* Marks block B, which must be locked exclusively and up to
+   date, as modified. */
+void
+cache_dirty (struct cache_block *b)
+{
+  ASSERT (b->rw.writer);
+  ASSERT (b->up_to_date);
+
+  b->dirty = true;
+}
+
+/* Unlocks block B, which was locked with the given TYPE. */
+void
+cache_unlock (struct cache_block *b, enum cache_lock_type type)
+{
+  if (type == CACHE_EXCLUSIVE)
+    rwlock_release_write (&b->rw);
+  else
+    rwlock_release_read (&b->rw);
+  release (b);
+}
+
+/* Drops SECTOR from the cache without writing it back, if it is
+   cached and no one is using it.  Used when SECTOR is freed, so
+   that its contents no longer matter. */
+void
+cache_free (block_sector_t sector)
+{
+  struct cache_block *b;
+
+  lock_acquire (&cache_sync);
+  b = lookup (sector);
+  if (b != NULL && b->users == 0)
+    {
+      b->sector = INVALID_SECTOR;
+      b->dirty = false;
+    }
+  lock_release (&cache_sync);
+}
+
+/* Asks the read-ahead thread to load SECTOR into the cache, and
+   returns without waiting for it. */
+void
+cache_readahead (block_sector_t sector)
+{
+  lock_acquire (&readahead_lock);
+  if (readahead_cnt < READAHEAD_MAX)
+    {
+      readahead_sectors[(readahead_head + readahead_cnt++)
+                        % READAHEAD_MAX] = sector;
+      readahead_cnt_total++;
+      cond_signal (&readahead_ready, &readahead_lock);
+    }
+  lock_release (&readahead_lock);
+}
+
+/* Returns the block that holds SECTOR, or a null pointer if it
+   is not cached.  cache_sync must be held. */
+static struct cache_block *
+lookup (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_CNT; i++)
+    if (cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Advances the clock hand to a block that no one is using and
+   that has not been accessed since the hand last passed it, and
+   returns that block.  Returns a null pointer if every block is
+   in use.  cache_sync must be held. */
+static struct cache_block *
+choose_victim (void)
+{
+  int i;
+
+  /* Two sweeps are enough: the first clears every accessed bit
+     that it passes. */
+  for (i = 0; i < 2 * CACHE_CNT; i++)
+    {
+      struct cache_block *b = &cache[hand];
+      hand = (hand + 1) % CACHE_CNT;
+      if (b->users > 0)
+        continue;
+      if (b->accessed)
+        b->accessed = false;
+      else
+        return b;
+    }
+  return NULL;
+}
+
+/* Gives up the current thread's use of block B. */
+static void
+release (struct cache_block *b)
+{
+  lock_acquire (&cache_sync);
+  ASSERT (b->users > 0);
+  if (--b->users == 0)
+    cond_signal (&block_released, &cache_sync);
+  lock_release (&cache_sync);
+}
+
+/* Thread function that writes modified blocks back to disk
+   periodically, so that little is lost if the machine stops. */
+static void
+write_behind_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (WRITE_BEHIND_INTERVAL);
+      cache_flush ();
+    }
+}
+
+/* Thread function that loads the sectors passed to
+   cache_readahead() into the cache.
+
+   It takes all the waiting sectors at once and submits a read
+   request for each one that is not already cached before
+   waiting for any of them, so that the block layer can merge
+   reads of consecutive sectors into a single command.  Blocks
+   that are busy are skipped rather than waited for, because
+   their sectors are evidently in use already and because
+   waiting while holding other blocks could deadlock.  For the
+   same reason, a sector for which no free block is at hand is
+   dropped. */
+static void
+readahead_daemon (void *aux UNUSED)
+{
+  static struct block_request requests[READAHEAD_MAX];
+  static struct cache_block *blocks[READAHEAD_MAX];
+
+  for (;;)
+    {
+      block_sector_t sectors[READAHEAD_MAX];
+      size_t sector_cnt, block_cnt;
+      size_t i;
+
+      lock_acquire (&readahead_lock);
+      while (readahead_cnt == 0)
+        cond_wait (&readahead_ready, &readahead_lock);
+      for (sector_cnt = 0; readahead_cnt > 0; sector_cnt++)
+        {
+          sectors[sector_cnt] = readahead_sectors[readahead_head];
+          readahead_head = (readahead_head + 1) % READAHEAD_MAX;
+          readahead_cnt--;
+        }
+      lock_release (&readahead_lock);
+
+      block_cnt = 0;
+      for (i = 0; i < sector_cnt; i++)
+        {
+          struct cache_block *b = get_block (sectors[i], false);
+
+          if (b == NULL)
+            continue;
+          if (!rwlock_try_acquire_read (&b->rw))
+            {
+              release (b);
+              continue;
+            }
+          if (b->up_to_date || !lock_try_acquire (&b->data_lock))
+            {
+              rwlock_release_read (&b->rw);
+              release (b);
+              continue;
+            }
+          if (b->up_to_date)
+            {
+              lock_release (&b->data_lock);
+              rwlock_release_read (&b->rw);
+              release (b);
+              continue;
+            }
+
+          block_request_init (&requests[block_cnt], false, b->sector, 1,
+                              b->data, NULL, NULL);
+          block_submit (fs_device, &requests[block_cnt]);
+          blocks[block_cnt++] = b;
+        }
+
+      for (i = 0; i < block_cnt; i++)
+        {
+          struct cache_block *b = blocks[i];
+
+          block_wait (&requests[i]);
+          b->up_to_date = true;
+          lock_release (&b->data_lock);
+          rwlock_release_read (&b->rw);
+          release (b);
+        }
+    }
+}
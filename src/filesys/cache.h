@@ -0,0 +1,28 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* How a cache block is locked. */
+enum cache_lock_type
+  {
+    CACHE_SHARED,               /* Any number of readers. */
+    CACHE_EXCLUSIVE             /* A single writer. */
+  };
+
+struct cache_block;
+
+void cache_init (void);
+void cache_flush (void);
+void cache_print_stats (void);
+
+struct cache_block *cache_lock (block_sector_t, enum cache_lock_type);
+void *cache_read (struct cache_block *);
+void *cache_zero (struct cache_block *);
+void cache_dirty (struct cache_block *);
+void cache_unlock (struct cache_block *, enum cache_lock_type);
+void cache_free (block_sector_t);
+void cache_readahead (block_sector_t);
+
+#endif /* filesys/cache.h */
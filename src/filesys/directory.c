@@ -1,41 +1,343 @@
 #include "filesys/directory.h"
+#include <hash.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <round.h>
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* A directory is a hash table on disk.  Its file is an array of
+   buckets, one per sector, and the entry for a name belongs in
+   the bucket selected by hashing the name.  A full bucket spills
+   into the buckets that follow it (wrapping around at the end),
+   and is flagged so that searches know to follow it there.  A
+   lookup therefore usually reads a single sector, however many
+   entries the directory holds.
+
+   When every bucket is full, the directory doubles its number of
+   buckets and rehashes its entries.
+
+   Every directory has entries named "." and "..", for itself
+   and for its parent, which dir_readdir() does not report.  The
+   root directory is its own parent.
+
+   Each directory's entries are protected by a reader/writer lock
+   kept in its in-memory inode, so lookups in a directory proceed
+   in parallel with each other, and operations on different
+   directories never wait for one another.  Removing a directory
+   locks its parent and then the directory itself; nothing locks
+   two directories in the other order.
+
+   Recent lookups are also remembered in memory, in a name cache
+   keyed by directory and name, so that a hit costs no sector
+   reads at all.  Resolving a path looks up each of its
+   components in turn, so the name cache serves as a cache of
+   recently resolved path components. */
 
 /* A directory. */
-struct dir 
+struct dir
   {
     struct inode *inode;                /* Backing store. */
-    off_t pos;                          /* Current position. */
+    off_t pos;                          /* Current position, as an
+                                           entry index. */
   };
 
 /* A single directory entry. */
-struct dir_entry 
+struct dir_entry
   {
     block_sector_t inode_sector;        /* Sector number of header. */
     char name[NAME_MAX + 1];            /* Null terminated file name. */
     bool in_use;                        /* In use or free? */
   };
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* Number of entries in a bucket. */
+#define BUCKET_ENTRY_CNT 25
+
+/* A bucket of directory entries.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct dir_bucket
+  {
+    struct dir_entry entries[BUCKET_ENTRY_CNT]; /* Entries. */
+    uint32_t overflowed;                /* Nonzero if an entry that hashed
+                                           here was put in a later bucket. */
+    uint8_t unused[8];                  /* Not used. */
+  };
+
+static bool grow (struct dir *);
+
+/* Name cache. */
+
+/* Number of entries in the name cache. */
+#define NAME_CACHE_CNT 128
+
+/* A name cache entry, recording that NAME in the directory whose
+   inode is in DIR_SECTOR has its inode in INODE_SECTOR. */
+struct name_cache_entry
+  {
+    struct hash_elem hash_elem;         /* Element in name_cache. */
+    struct list_elem lru_elem;          /* Element in name_cache_lru. */
+    block_sector_t dir_sector;          /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Name in directory. */
+    block_sector_t inode_sector;        /* Named file's inode sector. */
+  };
+
+static struct name_cache_entry name_cache_entries[NAME_CACHE_CNT];
+static struct hash name_cache;          /* Entries in use. */
+static struct list name_cache_lru;      /* All entries, most recent first. */
+static struct lock name_cache_lock;     /* Protects the name cache. */
+static long long name_cache_hits, name_cache_misses;
+
+static hash_hash_func name_cache_hash;
+static hash_less_func name_cache_less;
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  size_t i;
+
+  if (!hash_init (&name_cache, name_cache_hash, name_cache_less, NULL))
+    PANIC ("can't create directory name cache");
+  list_init (&name_cache_lru);
+  lock_init (&name_cache_lock);
+
+  /* Unused entries have no name and sit at the back of the LRU
+     list, so they are the first to be recycled. */
+  for (i = 0; i < NAME_CACHE_CNT; i++)
+    {
+      name_cache_entries[i].name[0] = '\0';
+      list_push_back (&name_cache_lru, &name_cache_entries[i].lru_elem);
+    }
+}
+
+/* Returns a hash value for name cache entry E. */
+static unsigned
+name_cache_hash (const struct hash_elem *e_, void *aux UNUSED)
+{
+  const struct name_cache_entry *e
+    = hash_entry (e_, struct name_cache_entry, hash_elem);
+  return hash_string (e->name) ^ hash_int (e->dir_sector);
+}
+
+/* Returns true if name cache entry A precedes B. */
+static bool
+name_cache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+                 void *aux UNUSED)
+{
+  const struct name_cache_entry *a
+    = hash_entry (a_, struct name_cache_entry, hash_elem);
+  const struct name_cache_entry *b
+    = hash_entry (b_, struct name_cache_entry, hash_elem);
+
+  if (a->dir_sector != b->dir_sector)
+    return a->dir_sector < b->dir_sector;
+  return strcmp (a->name, b->name) < 0;
+}
+
+/* Returns the name cache entry for NAME in the directory in
+   DIR_SECTOR, or a null pointer if there is none.
+   name_cache_lock must be held. */
+static struct name_cache_entry *
+name_cache_find (block_sector_t dir_sector, const char *name)
+{
+  struct name_cache_entry key;
+  struct hash_elem *e;
+
+  key.dir_sector = dir_sector;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&name_cache, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct name_cache_entry, hash_elem) : NULL;
+}
+
+/* Looks up NAME in the directory in DIR_SECTOR in the name cache.
+   If found, stores its inode sector into *INODE_SECTOR and
+   returns true; otherwise, returns false. */
+static bool
+name_cache_lookup (block_sector_t dir_sector, const char *name,
+                   block_sector_t *inode_sector)
+{
+  struct name_cache_entry *e;
+
+  lock_acquire (&name_cache_lock);
+  e = name_cache_find (dir_sector, name);
+  if (e != NULL)
+    {
+      *inode_sector = e->inode_sector;
+      list_remove (&e->lru_elem);
+      list_push_front (&name_cache_lru, &e->lru_elem);
+      name_cache_hits++;
+    }
+  else
+    name_cache_misses++;
+  lock_release (&name_cache_lock);
+
+  return e != NULL;
+}
+
+/* Records in the name cache that NAME in the directory in
+   DIR_SECTOR has its inode in INODE_SECTOR, recycling the least
+   recently used entry. */
+static void
+name_cache_insert (block_sector_t dir_sector, const char *name,
+                   block_sector_t inode_sector)
+{
+  struct name_cache_entry *e;
+
+  lock_acquire (&name_cache_lock);
+  e = name_cache_find (dir_sector, name);
+  if (e == NULL)
+    {
+      e = list_entry (list_back (&name_cache_lru),
+                      struct name_cache_entry, lru_elem);
+      if (e->name[0] != '\0')
+        hash_delete (&name_cache, &e->hash_elem);
+      e->dir_sector = dir_sector;
+      strlcpy (e->name, name, sizeof e->name);
+      hash_insert (&name_cache, &e->hash_elem);
+    }
+  e->inode_sector = inode_sector;
+  list_remove (&e->lru_elem);
+  list_push_front (&name_cache_lru, &e->lru_elem);
+  lock_release (&name_cache_lock);
+}
+
+/* Forgets name cache entry E.  name_cache_lock must be held. */
+static void
+name_cache_discard (struct name_cache_entry *e)
+{
+  hash_delete (&name_cache, &e->hash_elem);
+  e->name[0] = '\0';
+  list_remove (&e->lru_elem);
+  list_push_back (&name_cache_lru, &e->lru_elem);
+}
+
+/* Forgets any name cache entry for NAME in the directory in
+   DIR_SECTOR. */
+static void
+name_cache_remove (block_sector_t dir_sector, const char *name)
+{
+  struct name_cache_entry *e;
+
+  lock_acquire (&name_cache_lock);
+  e = name_cache_find (dir_sector, name);
+  if (e != NULL)
+    name_cache_discard (e);
+  lock_release (&name_cache_lock);
+}
+
+/* Forgets every name cache entry for the directory in
+   DIR_SECTOR, which is being removed.  Its sector may later be
+   reused for another directory. */
+static void
+name_cache_purge (block_sector_t dir_sector)
+{
+  size_t i;
+
+  lock_acquire (&name_cache_lock);
+  for (i = 0; i < NAME_CACHE_CNT; i++)
+    {
+      struct name_cache_entry *e = &name_cache_entries[i];
+      if (e->name[0] != '\0' && e->dir_sector == dir_sector)
+        name_cache_discard (e);
+    }
+  lock_release (&name_cache_lock);
+}
+
+/* Prints directory name cache statistics. */
+void
+dir_print_stats (void)
+{
+  printf ("Directory name cache: %lld hits, %lld misses\n",
+          name_cache_hits, name_cache_misses);
+}
+
+/* Buckets. */
+
+/* Returns the number of buckets in DIR. */
+static size_t
+bucket_cnt (const struct dir *dir)
+{
+  return inode_length (dir->inode) / BLOCK_SECTOR_SIZE;
+}
+
+/* Reads bucket IDX of DIR into *B.  Returns true if successful,
+   false if the directory is too short to hold it. */
+static bool
+read_bucket (const struct dir *dir, size_t idx, struct dir_bucket *b)
+{
+  return (inode_read_at (dir->inode, b, sizeof *b, idx * sizeof *b)
+          == sizeof *b);
+}
+
+/* Writes *B as bucket IDX of DIR.  Returns true if successful,
+   false on failure. */
+static bool
+write_bucket (struct dir *dir, size_t idx, const struct dir_bucket *b)
+{
+  return (inode_write_at (dir->inode, b, sizeof *b, idx * sizeof *b)
+          == sizeof *b);
+}
+
+/* Returns the bucket in which DIR's entry for NAME belongs, if
+   there is room for it there. */
+static size_t
+home_bucket (const struct dir *dir, const char *name)
+{
+  return hash_string (name) % bucket_cnt (dir);
+}
+
+/* Creates a directory with space for ENTRY_CNT entries, besides
+   "." and "..", in the given SECTOR.  Its parent is the
+   directory in PARENT_SECTOR.  Returns true if successful, false
+   on failure.  On failure, SECTOR is released along with
+   anything else the directory had allocated. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, block_sector_t parent_sector,
+            size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  size_t buckets = DIV_ROUND_UP (entry_cnt + 2, BUCKET_ENTRY_CNT);
+  struct inode *inode;
+  struct dir *dir;
+  bool success;
+
+  ASSERT (sizeof (struct dir_bucket) == BLOCK_SECTOR_SIZE);
+
+  if (!inode_create (sector, buckets * sizeof (struct dir_bucket), true))
+    {
+      free_map_release (sector, 1);
+      return false;
+    }
+  inode = inode_open (sector);
+  if (inode == NULL)
+    {
+      free_map_release (sector, 1);
+      return false;
+    }
+  dir = dir_open (inode_reopen (inode));
+  success = (dir != NULL
+             && dir_add (dir, ".", sector)
+             && dir_add (dir, "..", parent_sector));
+  dir_close (dir);
+
+  /* Removing the inode releases SECTOR and the buckets. */
+  if (!success)
+    inode_remove (inode);
+  inode_close (inode);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
-   it takes ownership.  Returns a null pointer on failure. */
+   it takes ownership.  Returns a null pointer on failure,
+   including when INODE is not a directory. */
 struct dir *
-dir_open (struct inode *inode) 
+dir_open (struct inode *inode)
 {
   struct dir *dir = calloc (1, sizeof *dir);
-  if (inode != NULL && dir != NULL)
+  if (inode != NULL && dir != NULL && inode_is_dir (inode))
     {
       dir->inode = inode;
       dir->pos = 0;
@@ -45,7 +347,7 @@ dir_open (struct inode *inode)
     {
       inode_close (inode);
       free (dir);
-      return NULL; 
+      return NULL;
     }
 }
 
@@ -60,14 +362,14 @@ dir_open_root (void)
 /* Opens and returns a new directory for the same inode as DIR.
    Returns a null pointer on failure. */
 struct dir *
-dir_reopen (struct dir *dir) 
+dir_reopen (struct dir *dir)
 {
   return dir_open (inode_reopen (dir->inode));
 }
 
 /* Destroys DIR and frees associated resources. */
 void
-dir_close (struct dir *dir) 
+dir_close (struct dir *dir)
 {
   if (dir != NULL)
     {
@@ -78,36 +380,50 @@ dir_close (struct dir *dir)
 
 /* Returns the inode encapsulated by DIR. */
 struct inode *
-dir_get_inode (struct dir *dir) 
+dir_get_inode (struct dir *dir)
 {
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
-   If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+/* Searches DIR on disk for a file with the given NAME, using B
+   as scratch space.
+   If successful, returns true, leaves the bucket holding the
+   entry in *B, and sets *BUCKETP and *SLOTP to the bucket and
+   the entry's index within it if they are non-null.
+   Otherwise, returns false. */
 static bool
-lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+lookup (const struct dir *dir, const char *name, struct dir_bucket *b,
+        size_t *bucketp, size_t *slotp)
 {
-  struct dir_entry e;
-  size_t ofs;
-  
+  size_t cnt = bucket_cnt (dir);
+  size_t idx = home_bucket (dir, name);
+  size_t probes;
+
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
+  for (probes = 0; probes < cnt && read_bucket (dir, idx, b); probes++)
+    {
+      size_t slot;
+
+      for (slot = 0; slot < BUCKET_ENTRY_CNT; slot++)
+        {
+          struct dir_entry *e = &b->entries[slot];
+          if (e->in_use && !strcmp (name, e->name))
+            {
+              if (bucketp != NULL)
+                *bucketp = idx;
+              if (slotp != NULL)
+                *slotp = slot;
+              return true;
+            }
+        }
+
+      /* Entries for NAME never went past this bucket. */
+      if (!b->overflowed)
+        break;
+      idx = (idx + 1) % cnt;
+    }
   return false;
 }
 
@@ -117,21 +433,84 @@ lookup (const struct dir *dir, const char *name,
    a null pointer.  The caller must close *INODE. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
-            struct inode **inode) 
+            struct inode **inode)
 {
-  struct dir_entry e;
+  block_sector_t dir_sector = inode_get_inumber (dir->inode);
+  block_sector_t inode_sector;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  *inode = NULL;
+  if (strlen (name) > NAME_MAX)
+    return false;
+
+  /* The name cache is consulted with DIR locked, so that the
+     entry cannot be removed, and its inode's sector reused,
+     before the inode is opened. */
+  rwlock_acquire_read (inode_get_dir_lock (dir->inode));
+  if (inode_is_removed (dir->inode))
+    ;
+  else if (name_cache_lookup (dir_sector, name, &inode_sector))
+    *inode = inode_open (inode_sector);
   else
-    *inode = NULL;
+    {
+      struct dir_bucket *b = malloc (sizeof *b);
+      size_t slot;
+
+      if (b != NULL && lookup (dir, name, b, NULL, &slot))
+        {
+          inode_sector = b->entries[slot].inode_sector;
+          name_cache_insert (dir_sector, name, inode_sector);
+          *inode = inode_open (inode_sector);
+        }
+      free (b);
+    }
+  rwlock_release_read (inode_get_dir_lock (dir->inode));
 
   return *inode != NULL;
 }
 
+/* Tries to put an entry for NAME, whose inode is in
+   INODE_SECTOR, into DIR, using B as scratch space.  Returns
+   true if successful, false if every bucket is full or a disk
+   error occurs. */
+static bool
+insert (struct dir *dir, const char *name, block_sector_t inode_sector,
+        struct dir_bucket *b)
+{
+  size_t cnt = bucket_cnt (dir);
+  size_t idx = home_bucket (dir, name);
+  size_t probes;
+
+  for (probes = 0; probes < cnt && read_bucket (dir, idx, b); probes++)
+    {
+      size_t slot;
+
+      for (slot = 0; slot < BUCKET_ENTRY_CNT; slot++)
+        {
+          struct dir_entry *e = &b->entries[slot];
+          if (!e->in_use)
+            {
+              e->in_use = true;
+              strlcpy (e->name, name, sizeof e->name);
+              e->inode_sector = inode_sector;
+              return write_bucket (dir, idx, b);
+            }
+        }
+
+      /* Full.  Flag it so that lookups continue past it. */
+      if (!b->overflowed)
+        {
+          b->overflowed = 1;
+          if (!write_bucket (dir, idx, b))
+            return false;
+        }
+      idx = (idx + 1) % cnt;
+    }
+  return false;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
@@ -141,8 +520,7 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
-  struct dir_entry e;
-  off_t ofs;
+  struct dir_bucket *b;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -152,58 +530,171 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
+  rwlock_acquire_write (inode_get_dir_lock (dir->inode));
+
+  /* Nothing may be added to a removed directory.  Check that
+     NAME is not in use. */
+  if (inode_is_removed (dir->inode) || lookup (dir, name, b, NULL, NULL))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
+  /* Insert, doubling the directory's buckets if they are all
+     full. */
+  success = (insert (dir, name, inode_sector, b)
+             || (grow (dir) && insert (dir, name, inode_sector, b)));
+  if (success)
+    name_cache_insert (inode_get_inumber (dir->inode), name, inode_sector);
+
+ done:
+  rwlock_release_write (inode_get_dir_lock (dir->inode));
+  free (b);
+  return success;
+}
+
+/* Doubles the number of buckets in DIR and redistributes its
+   entries among them.  Returns true if DIR gained any buckets,
+   false on failure.  DIR's lock must be held exclusively.
+
+   The new buckets are added in ascending order, so that a full
+   disk can only stop the growth part of the way, and the old
+   buckets are only cleared once that is done.  Every bucket then
+   has a sector, so redistributing the entries among however many
+   buckets there are needs no more space and cannot lose them. */
+static bool
+grow (struct dir *dir)
+{
+  size_t old_cnt = bucket_cnt (dir);
+  size_t new_cnt = old_cnt * 2;
+  struct dir_entry *entries;
+  struct dir_bucket *b;
+  size_t entry_cnt = 0;
+  size_t idx, i;
+  bool success = false;
+
+  entries = malloc (old_cnt * BUCKET_ENTRY_CNT * sizeof *entries);
+  b = malloc (sizeof *b);
+  if (entries == NULL || b == NULL)
+    goto done;
+
+  /* Save the entries. */
+  for (idx = 0; idx < old_cnt; idx++)
+    {
+      if (!read_bucket (dir, idx, b))
+        goto done;
+      for (i = 0; i < BUCKET_ENTRY_CNT; i++)
+        if (b->entries[i].in_use)
+          entries[entry_cnt++] = b->entries[i];
+    }
+
+  /* Add empty new buckets, as many as will fit. */
+  memset (b, 0, sizeof *b);
+  for (idx = old_cnt; idx < new_cnt; idx++)
+    if (!write_bucket (dir, idx, b))
       break;
+  if (bucket_cnt (dir) == old_cnt)
+    goto done;
 
-  /* Write slot. */
-  e.in_use = true;
-  strlcpy (e.name, name, sizeof e.name);
-  e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  /* Empty the old buckets and put the entries back. */
+  for (idx = 0; idx < old_cnt; idx++)
+    if (!write_bucket (dir, idx, b))
+      goto done;
+  for (i = 0; i < entry_cnt; i++)
+    if (!insert (dir, entries[i].name, entries[i].inode_sector, b))
+      goto done;
+  success = true;
 
  done:
+  free (b);
+  free (entries);
   return success;
 }
 
+/* Returns true if DIR contains no entries besides "." and "..",
+   false otherwise. */
+static bool
+is_empty (struct dir *dir)
+{
+  struct dir_bucket *b = malloc (sizeof *b);
+  size_t cnt = bucket_cnt (dir);
+  size_t idx, slot;
+  bool empty = b != NULL;
+
+  for (idx = 0; empty && idx < cnt; idx++)
+    {
+      if (!read_bucket (dir, idx, b))
+        {
+          empty = false;
+          break;
+        }
+      for (slot = 0; slot < BUCKET_ENTRY_CNT; slot++)
+        {
+          struct dir_entry *e = &b->entries[slot];
+          if (e->in_use && strcmp (e->name, ".") && strcmp (e->name, ".."))
+            {
+              empty = false;
+              break;
+            }
+        }
+    }
+  free (b);
+  return empty;
+}
+
 /* Removes any entry for NAME in DIR.
-   Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   Returns true if successful, false on failure, which occurs if
+   there is no file with the given NAME, if NAME is "." or "..",
+   or if NAME is a directory that is not empty.  A directory that
+   is removed while open, for example as some process's current
+   directory, stays usable but cannot gain new entries. */
 bool
-dir_remove (struct dir *dir, const char *name) 
+dir_remove (struct dir *dir, const char *name)
 {
-  struct dir_entry e;
+  struct dir_bucket *b;
   struct inode *inode = NULL;
+  struct dir *child = NULL;
   bool success = false;
-  off_t ofs;
+  size_t idx, slot;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (!strcmp (name, ".") || !strcmp (name, ".."))
+    return false;
+
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
+  rwlock_acquire_write (inode_get_dir_lock (dir->inode));
+
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  if (!lookup (dir, name, b, &idx, &slot))
     goto done;
 
   /* Open inode. */
-  inode = inode_open (e.inode_sector);
+  inode = inode_open (b->entries[slot].inode_sector);
   if (inode == NULL)
     goto done;
 
+  /* Only an empty directory may be removed.  Keep it locked
+     until it is marked removed, so that nothing is added to it
+     in the meantime. */
+  if (inode_is_dir (inode))
+    {
+      child = dir_open (inode_reopen (inode));
+      if (child == NULL)
+        goto done;
+      rwlock_acquire_write (inode_get_dir_lock (inode));
+      if (!is_empty (child))
+        goto done;
+      name_cache_purge (inode_get_inumber (inode));
+    }
+
   /* Erase directory entry. */
-  e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
+  b->entries[slot].in_use = false;
+  name_cache_remove (inode_get_inumber (dir->inode), name);
+  if (!write_bucket (dir, idx, b))
     goto done;
 
   /* Remove inode. */
@@ -211,26 +702,62 @@ dir_remove (struct dir *dir, const char *name)
   success = true;
 
  done:
+  if (child != NULL)
+    {
+      rwlock_release_write (inode_get_dir_lock (inode));
+      dir_close (child);
+    }
+  rwlock_release_write (inode_get_dir_lock (dir->inode));
   inode_close (inode);
+  free (b);
   return success;
 }
 
-/* Reads the next directory entry in DIR and stores the name in
-   NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+/* Reads the next directory entry in DIR, other than "." and
+   "..", and stores the name in NAME.  Returns true if
+   successful, false if the directory contains no more
+   entries. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool found = false;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  rwlock_acquire_read (inode_get_dir_lock (dir->inode));
+  while (!found)
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
+      size_t idx = dir->pos / BUCKET_ENTRY_CNT;
+      size_t slot = dir->pos % BUCKET_ENTRY_CNT;
+      off_t ofs = idx * sizeof (struct dir_bucket) + slot * sizeof e;
+
+      if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+        break;
+      dir->pos++;
+      if (e.in_use && strcmp (e.name, ".") && strcmp (e.name, ".."))
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
+          found = true;
+        }
     }
-  return false;
+  rwlock_release_read (inode_get_dir_lock (dir->inode));
+  return found;
+}
+
+/* Sets DIR's position, as used by dir_readdir(), to POS, which
+   must have been returned by dir_tell() on a directory for the
+   same inode. */
+void
+dir_seek (struct dir *dir, off_t pos)
+{
+  ASSERT (dir != NULL);
+  ASSERT (pos >= 0);
+  dir->pos = pos;
+}
+
+/* Returns DIR's position, as used by dir_readdir(). */
+off_t
+dir_tell (struct dir *dir)
+{
+  ASSERT (dir != NULL);
+  return dir->pos;
 }
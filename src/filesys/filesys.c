@@ -2,10 +2,12 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
@@ -13,21 +15,38 @@ struct block *fs_device;
 static void do_format (void);
 
 /* Initializes the file system module.
-   If FORMAT is true, reformats the file system. */
+   If FORMAT is true, reformats the file system so that its files
+   use LAYOUT; otherwise, new files use the layout the file
+   system was formatted with. */
 void
-filesys_init (bool format) 
+filesys_init (bool format, enum inode_layout layout) 
 {
+  struct inode *free_map_inode;
+
   fs_device = block_get_role (BLOCK_FILESYS);
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  file_init ();
+  dir_init ();
   free_map_init ();
 
   if (format) 
-    do_format ();
+    {
+      inode_set_default_layout (layout);
+      do_format ();
+    }
 
   free_map_open ();
+
+  /* The free map's inode records the format's layout. */
+  free_map_inode = inode_open (FREE_MAP_SECTOR);
+  if (free_map_inode == NULL)
+    PANIC ("can't open free map inode");
+  inode_set_default_layout (inode_get_layout (free_map_inode));
+  inode_close (free_map_inode);
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -36,8 +55,161 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  cache_flush ();
 }
 
+/* Extracts a file name part from *SRCP into PART, and updates
+   *SRCP so that the next call will return the next file name
+   part.  Returns 1 if successful, 0 at end of string, -1 for a
+   too-long file name part. */
+static int
+get_next_part (char part[NAME_MAX + 1], const char **srcp)
+{
+  const char *src = *srcp;
+  char *dst = part;
+
+  /* Skip leading slashes.  If it's all slashes, we're done. */
+  while (*src == '/')
+    src++;
+  if (*src == '\0')
+    return 0;
+
+  /* Copy up to NAME_MAX characters from SRC to DST.  Add null
+     terminator. */
+  while (*src != '/' && *src != '\0')
+    {
+      if (dst < part + NAME_MAX)
+        *dst++ = *src;
+      else
+        return -1;
+      src++;
+    }
+  *dst = '\0';
+
+  /* Advance source pointer. */
+  *srcp = src;
+  return 1;
+}
+
+/* Returns the directory in which relative paths are resolved:
+   the running process's current directory if it has one,
+   otherwise the root directory.  The caller must close it. */
+static struct dir *
+open_cwd (void)
+{
+#ifdef USERPROG
+  struct dir *cwd = thread_current ()->cwd;
+  if (cwd != NULL)
+    return dir_reopen (cwd);
+#endif
+  return dir_open_root ();
+}
+
+/* Resolves PATH, relative to the current directory unless it
+   begins with "/", into the directory that contains its last
+   component and the last component's name.  Stores the
+   directory, which the caller must close, into *DIRP and the
+   name into NAME.  The name is "." if PATH names the root
+   directory.
+
+   Each component is looked up with dir_lookup(), which consults
+   the directory name cache first, so resolving a path seen
+   recently reads only inodes that are already open or in the
+   buffer cache.
+
+   Returns true if successful, false if PATH is empty, has a
+   component that is too long, or passes through a name that
+   does not exist or is not a directory. */
+static bool
+resolve (const char *path, struct dir **dirp, char name[NAME_MAX + 1])
+{
+  char next[NAME_MAX + 1];
+  struct dir *dir;
+  int ok;
+
+  *dirp = NULL;
+  if (*path == '\0')
+    return false;
+
+  dir = *path == '/' ? dir_open_root () : open_cwd ();
+  if (dir == NULL)
+    return false;
+
+  /* NAME holds the component just read and NEXT the one after
+     it.  Whenever there is a next component, NAME must be a
+     directory to descend into. */
+  ok = get_next_part (name, &path);
+  if (ok == 0)
+    strlcpy (name, ".", NAME_MAX + 1);
+  while (ok > 0 && (ok = get_next_part (next, &path)) > 0)
+    {
+      struct inode *inode;
+
+      dir_lookup (dir, name, &inode);
+      dir_close (dir);
+      dir = dir_open (inode);
+      if (dir == NULL)
+        return false;
+      strlcpy (name, next, NAME_MAX + 1);
+    }
+
+  if (ok < 0)
+    {
+      dir_close (dir);
+      return false;
+    }
+  *dirp = dir;
+  return true;
+}
+
+/* Creates an ordinary file named NAME with the given
+   INITIAL_SIZE, or a directory if IS_DIR is true.  Returns true
+   if successful, false otherwise. */
+static bool
+create (const char *name_, off_t initial_size, bool is_dir)
+{
+  block_sector_t inode_sector = 0;
+  char name[NAME_MAX + 1];
+  struct dir *dir;
+  bool created = false;
+  bool success;
+
+  success = (resolve (name_, &dir, name)
+             && free_map_allocate (1, &inode_sector));
+  if (success)
+    {
+      if (is_dir)
+        created = dir_create (inode_sector,
+                              inode_get_inumber (dir_get_inode (dir)), 0);
+      else
+        created = inode_create (inode_sector, initial_size, false);
+      success = created && dir_add (dir, name, inode_sector);
+    }
+  if (!success)
+    {
+      if (created)
+        {
+          /* Removing the new inode releases its sector along
+             with its data, or its buckets for a directory. */
+          struct inode *inode = inode_open (inode_sector);
+          if (inode != NULL)
+            {
+              inode_remove (inode);
+              inode_close (inode);
+            }
+        }
+      else if (inode_sector != 0 && !is_dir)
+        {
+          /* A failed dir_create() has released the sector
+             itself. */
+          free_map_release (inode_sector, 1);
+        }
+    }
+  dir_close (dir);
+
+  return success;
+}
+
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
@@ -45,58 +217,86 @@ filesys_done (void)
 bool
 filesys_create (const char *name, off_t initial_size) 
 {
-  block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
-  if (!success && inode_sector != 0) 
-    free_map_release (inode_sector, 1);
-  dir_close (dir);
+  return create (name, initial_size, false);
+}
 
-  return success;
+/* Creates a directory named NAME.
+   Returns true if successful, false otherwise.
+   Fails if a file or directory named NAME already exists,
+   or if internal memory allocation fails. */
+bool
+filesys_mkdir (const char *name) 
+{
+  return create (name, 0, true);
 }
 
-/* Opens the file with the given NAME.
+/* Opens the file or directory with the given NAME.
    Returns the new file if successful or a null pointer
    otherwise.
    Fails if no file named NAME exists,
    or if an internal memory allocation fails. */
 struct file *
-filesys_open (const char *name)
+filesys_open (const char *name_)
 {
-  struct dir *dir = dir_open_root ();
+  char name[NAME_MAX + 1];
+  struct dir *dir;
   struct inode *inode = NULL;
 
-  if (dir != NULL)
+  if (resolve (name_, &dir, name))
     dir_lookup (dir, name, &inode);
   dir_close (dir);
 
   return file_open (inode);
 }
 
-/* Deletes the file named NAME.
+/* Deletes the file or empty directory named NAME.
    Returns true if successful, false on failure.
-   Fails if no file named NAME exists,
-   or if an internal memory allocation fails. */
+   Fails if no file named NAME exists, if NAME is a directory
+   that is not empty or is the root directory, or if an
+   internal memory allocation fails. */
 bool
-filesys_remove (const char *name) 
+filesys_remove (const char *name_) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char name[NAME_MAX + 1];
+  struct dir *dir;
+  bool success = resolve (name_, &dir, name) && dir_remove (dir, name);
   dir_close (dir); 
 
   return success;
 }
-
+
+#ifdef USERPROG
+/* Changes the running process's current directory to NAME.
+   Returns true if successful, false if NAME does not exist or
+   is not a directory. */
+bool
+filesys_chdir (const char *name_) 
+{
+  char name[NAME_MAX + 1];
+  struct dir *dir;
+  struct inode *inode = NULL;
+  struct thread *cur = thread_current ();
+
+  if (resolve (name_, &dir, name))
+    dir_lookup (dir, name, &inode);
+  dir_close (dir);
+
+  dir = dir_open (inode);
+  if (dir == NULL)
+    return false;
+  dir_close (cur->cwd);
+  cur->cwd = dir;
+  return true;
+}
+#endif
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
   free_map_close ();
   printf ("done.\n");
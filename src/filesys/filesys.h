@@ -2,6 +2,7 @@
 #define FILESYS_FILESYS_H
 
 #include <stdbool.h>
+#include "filesys/inode.h"
 #include "filesys/off_t.h"
 
 /* Sectors of system file inodes. */
@@ -11,10 +12,14 @@
 /* Block device that contains the file system. */
 struct block *fs_device;
 
-void filesys_init (bool format);
+void filesys_init (bool format, enum inode_layout);
 void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size);
+bool filesys_mkdir (const char *name);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
+#ifdef USERPROG
+bool filesys_chdir (const char *name);
+#endif
 
 #endif /* filesys/filesys.h */
@@ -1,25 +1,105 @@
 #include "filesys/inode.h"
-#include <list.h>
 #include <debug.h>
+#include <hash.h>
+#include <stdio.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of sectors of each kind in an inode's index.
+   Data sectors are reached through the direct sectors first,
+   then through the indirect sector, which lists PTRS_PER_SECTOR
+   data sectors, then through the doubly indirect sector, which
+   lists PTRS_PER_SECTOR indirect sectors. */
+#define DIRECT_CNT 123
+#define INDIRECT_CNT 1
+#define DBL_INDIRECT_CNT 1
+#define SECTOR_CNT (DIRECT_CNT + INDIRECT_CNT + DBL_INDIRECT_CNT)
+
+/* Sector numbers that fit in an index sector. */
+#define PTRS_PER_SECTOR ((off_t) (BLOCK_SECTOR_SIZE / sizeof (block_sector_t)))
+
+/* Largest file size in bytes, a little over 8 MB.  Files with
+   extents are held to the same limit. */
+#define INODE_SPAN ((DIRECT_CNT                                             \
+                     + PTRS_PER_SECTOR * INDIRECT_CNT                       \
+                     + PTRS_PER_SECTOR * PTRS_PER_SECTOR * DBL_INDIRECT_CNT) \
+                    * BLOCK_SECTOR_SIZE)
+
+/* A run of LENGTH consecutive sectors starting at START. */
+struct extent
+  {
+    block_sector_t start;               /* First sector. */
+    block_sector_t length;              /* Number of sectors, 0 if unused. */
+  };
+
+/* Number of extents in an inode and in an overflow sector. */
+#define INODE_EXTENT_CNT 62
+#define OVERFLOW_EXTENT_CNT 63
+
+/* Sector holding extents that do not fit in the inode, or in
+   the previous overflow sector. */
+struct extent_overflow
+  {
+    struct extent extents[OVERFLOW_EXTENT_CNT]; /* Extents. */
+    block_sector_t next;                /* Next overflow sector, or 0. */
+    uint32_t unused;                    /* Not used. */
+  };
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   An INODE_INDEXED inode lists its data sectors in SECTORS.  A
+   sector number of 0 there, or in an indirect sector, means that
+   no sector is allocated there.  (Sector 0 always holds the free
+   map's inode, so it is never a data sector.)  A file may have
+   such holes wherever it was never written, which read back as
+   zeros.
+
+   An INODE_EXTENTS inode maps its data as a sequence of extents,
+   the first sector of the file being the first sector of the
+   first extent, and so on.  Used extents come first, followed by
+   unused ones with length 0; when the ones in the inode are all
+   used, the list continues in a chain of overflow sectors.  Such
+   a file has no holes: growing it allocates every sector up to
+   the new end. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    union
+      {
+        /* INODE_INDEXED: direct, then indirect, then doubly
+           indirect sectors. */
+        block_sector_t sectors[SECTOR_CNT];
+
+        /* INODE_EXTENTS. */
+        struct
+          {
+            struct extent extents[INODE_EXTENT_CNT];
+            block_sector_t overflow;    /* First overflow sector, or 0. */
+          };
+      };
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint16_t layout;                    /* An enum inode_layout. */
+    uint16_t is_dir;                    /* Nonzero if a directory. */
   };
 
+/* Number of sectors to read ahead of a sequential reader.  The
+   block layer merges them into one command when they are
+   consecutive on disk, as they are within an extent. */
+#define READAHEAD_SECTORS 8
+
+/* Layout for new inodes. */
+static enum inode_layout default_layout;
+
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t
@@ -28,49 +108,571 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* In-memory inode.
+
+   LOCK protects DATA and DENY_WRITE_CNT.  Reading and writing
+   sectors that are already allocated need only hold it shared,
+   so any number of readers and writers may work on the same
+   file at once; the buffer cache keeps each sector consistent.
+   Allocating sectors, changing the length, and denying or
+   allowing writes hold it exclusively, but only for as long as
+   that takes.
+
+   EXTEND_LOCK is held for the whole of a write that extends the
+   file, so that extending writes happen one at a time and the
+   length only ever grows, without keeping readers out while the
+   data is copied.
+
+   DIR_LOCK is used only by directories, in directory.c, to
+   protect their entries.
+
+   READ_END and READAHEAD_END are hints, updated without a lock. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    off_t read_end;                     /* Offset just past last read. */
+    off_t readahead_end;                /* Offset past last read-ahead. */
+    struct rwlock lock;                 /* Protects data. */
+    struct lock extend_lock;            /* Held while extending. */
+    struct rwlock dir_lock;             /* Protects directory entries. */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* Allocates a sector, fills it with zeros in the buffer cache,
+   and stores its number into *SECTORP.  Returns true if
+   successful, false if the disk is full. */
+static bool
+allocate_zeroed (block_sector_t *sectorp) 
+{
+  struct cache_block *b;
+
+  if (!free_map_allocate (1, sectorp))
+    return false;
+  b = cache_lock (*sectorp, CACHE_EXCLUSIVE);
+  cache_zero (b);
+  cache_unlock (b, CACHE_EXCLUSIVE);
+  return true;
+}
+
+/* Returns the sector number in *SLOT, an entry in an inode's
+   index.  If it is 0 and ALLOCATE is true, first allocates a
+   zeroed sector for it and sets *CHANGED to true.  Returns 0 if
+   the slot is empty and could not be filled. */
+static block_sector_t
+index_slot (block_sector_t *slot, bool allocate, bool *changed) 
+{
+  if (*slot == 0 && allocate && allocate_zeroed (slot))
+    *changed = true;
+  return *slot;
+}
+
+/* Returns the sector number in entry IDX of indirect sector
+   SECTOR.  If it is 0 and ALLOCATE is true, first allocates a
+   zeroed sector for it.  Returns 0 if the entry is empty and
+   could not be filled. */
+static block_sector_t
+indirect_entry (block_sector_t sector, off_t idx, bool allocate) 
+{
+  struct cache_block *b;
+  block_sector_t *entries;
+  block_sector_t entry;
+
+  ASSERT (idx >= 0 && idx < PTRS_PER_SECTOR);
+
+  b = cache_lock (sector, CACHE_SHARED);
+  entry = ((block_sector_t *) cache_read (b))[idx];
+  cache_unlock (b, CACHE_SHARED);
+  if (entry != 0 || !allocate)
+    return entry;
+
+  /* Check again with the sector locked for modification, in case
+     another thread filled the entry in meanwhile. */
+  b = cache_lock (sector, CACHE_EXCLUSIVE);
+  entries = cache_read (b);
+  entry = entries[idx];
+  if (entry == 0 && allocate_zeroed (&entry))
+    {
+      entries[idx] = entry;
+      cache_dirty (b);
+    }
+  cache_unlock (b, CACHE_EXCLUSIVE);
+  return entry;
+}
+
+/* Returns the sector that holds data sector IDX, counting from
+   0, of the INODE_INDEXED file described by DISK.  If IDX is a
+   hole and ALLOCATE is true, first allocates zeroed sectors for
+   it and for any indirect sectors needed to reach it, and sets
+   *CHANGED to true if DISK itself was modified.  Returns 0 if
+   IDX is a hole that was not filled or is beyond the largest
+   possible file. */
+static block_sector_t
+indexed_get_sector (struct inode_disk *disk, off_t idx, bool allocate,
+                    bool *changed) 
+{
+  block_sector_t indirect;
+
+  ASSERT (idx >= 0);
+  ASSERT (!allocate || changed != NULL);
+
+  /* Direct sectors, looked up without any disk access. */
+  if (idx < DIRECT_CNT)
+    return index_slot (&disk->sectors[idx], allocate, changed);
+  idx -= DIRECT_CNT;
+
+  /* Indirect sector. */
+  if (idx < PTRS_PER_SECTOR)
+    {
+      indirect = index_slot (&disk->sectors[DIRECT_CNT], allocate, changed);
+      return indirect != 0 ? indirect_entry (indirect, idx, allocate) : 0;
+    }
+  idx -= PTRS_PER_SECTOR;
+
+  /* Doubly indirect sector. */
+  if (idx < PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+    {
+      block_sector_t dbl_indirect;
+
+      dbl_indirect = index_slot (&disk->sectors[DIRECT_CNT + INDIRECT_CNT],
+                                 allocate, changed);
+      if (dbl_indirect == 0)
+        return 0;
+      indirect = indirect_entry (dbl_indirect, idx / PTRS_PER_SECTOR,
+                                 allocate);
+      if (indirect == 0)
+        return 0;
+      return indirect_entry (indirect, idx % PTRS_PER_SECTOR, allocate);
+    }
+
+  return 0;
+}
+
+/* Frees SECTOR and, if LEVEL is greater than 0, every sector
+   reachable from it as an indirect sector with LEVEL levels of
+   indirection. */
+static void
+release_sectors (block_sector_t sector, int level) 
+{
+  if (level > 0)
+    {
+      struct cache_block *b = cache_lock (sector, CACHE_SHARED);
+      block_sector_t *entries = cache_read (b);
+      off_t i;
+
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        if (entries[i] != 0)
+          release_sectors (entries[i], level - 1);
+      cache_unlock (b, CACHE_SHARED);
+    }
+  cache_free (sector);
+  free_map_release (sector, 1);
+}
+
+/* Frees every data and indirect sector in DISK's index. */
+static void
+indexed_release (struct inode_disk *disk) 
+{
+  int i;
+
+  for (i = 0; i < SECTOR_CNT; i++)
+    if (disk->sectors[i] != 0)
+      {
+        int level = (i < DIRECT_CNT ? 0
+                     : i < DIRECT_CNT + INDIRECT_CNT ? 1
+                     : 2);
+        release_sectors (disk->sectors[i], level);
+        disk->sectors[i] = 0;
+      }
+}
+
+/* Extents. */
+
+/* Searches the extents of DISK for data sector IDX of the file,
+   counting from 0, and returns the sector that holds it.  If IDX
+   is beyond the last extent, returns 0, and also stores the
+   number of sectors in all the extents into *MAPPED and the
+   sector just past the last extent, or 0 if there are no
+   extents, into *END. */
+static block_sector_t
+extent_find (const struct inode_disk *disk, off_t idx,
+             off_t *mapped, block_sector_t *end) 
+{
+  const struct extent *extents = disk->extents;
+  size_t extent_cnt = INODE_EXTENT_CNT;
+  block_sector_t next = disk->overflow;
+  struct cache_block *b = NULL;
+  block_sector_t sector = 0;
+
+  *mapped = 0;
+  *end = 0;
+  for (;;)
+    {
+      size_t i;
+
+      for (i = 0; i < extent_cnt && extents[i].length != 0; i++)
+        {
+          if (idx < (off_t) extents[i].length)
+            {
+              sector = extents[i].start + idx;
+              goto done;
+            }
+          idx -= extents[i].length;
+          *mapped += extents[i].length;
+          *end = extents[i].start + extents[i].length;
+        }
+      if (i < extent_cnt || next == 0)
+        break;
+
+      /* Continue in the next overflow sector. */
+      if (b != NULL)
+        cache_unlock (b, CACHE_SHARED);
+      b = cache_lock (next, CACHE_SHARED);
+      extents = ((struct extent_overflow *) cache_read (b))->extents;
+      extent_cnt = OVERFLOW_EXTENT_CNT;
+      next = ((struct extent_overflow *) cache_read (b))->next;
+    }
+
+ done:
+  if (b != NULL)
+    cache_unlock (b, CACHE_SHARED);
+  return sector;
+}
+
+/* Adds the CNT sectors starting at START to the end of DISK's
+   extents, lengthening the last extent if START follows it
+   directly.  Sets *CHANGED to true if DISK itself was modified.
+   Returns true if successful, false if a new overflow sector was
+   needed but could not be allocated. */
+static bool
+extent_add (struct inode_disk *disk, block_sector_t start,
+            block_sector_t cnt, bool *changed) 
+{
+  struct extent *extents = disk->extents;
+  size_t extent_cnt = INODE_EXTENT_CNT;
+  block_sector_t *next = &disk->overflow;
+  struct cache_block *b = NULL;
+  bool success = true;
+
+  for (;;)
+    {
+      bool linked = false;
+      size_t i;
+
+      for (i = 0; i < extent_cnt && extents[i].length != 0; i++)
+        continue;
+
+      if (i == extent_cnt && *next == 0)
+        {
+          if (!allocate_zeroed (next))
+            {
+              success = false;
+              break;
+            }
+          linked = true;
+        }
+      if (i == extent_cnt)
+        {
+          /* This group of extents is full.  Move on to the next
+             overflow sector, which we may have just allocated. */
+          struct cache_block *next_b = cache_lock (*next, CACHE_EXCLUSIVE);
+          struct extent_overflow *overflow = cache_read (next_b);
+
+          if (b != NULL)
+            {
+              if (linked)
+                cache_dirty (b);
+              cache_unlock (b, CACHE_EXCLUSIVE);
+            }
+          else if (linked)
+            *changed = true;
+          b = next_b;
+          extents = overflow->extents;
+          extent_cnt = OVERFLOW_EXTENT_CNT;
+          next = &overflow->next;
+          continue;
+        }
+
+      if (i > 0 && extents[i - 1].start + extents[i - 1].length == start)
+        extents[i - 1].length += cnt;
+      else
+        {
+          extents[i].start = start;
+          extents[i].length = cnt;
+        }
+      break;
+    }
+
+  /* Whatever group of extents we stopped in was modified, unless
+     we failed. */
+  if (b != NULL)
+    {
+      if (success)
+        cache_dirty (b);
+      cache_unlock (b, CACHE_EXCLUSIVE);
+    }
+  else if (success)
+    *changed = true;
+  return success;
+}
+
+/* Extends the file described by DISK, whose extents currently
+   hold MAPPED sectors ending just before END, by CNT zeroed
+   sectors.  Prefers the sectors directly after END, so that the
+   last extent just grows, and otherwise the longest free run up
+   to CNT sectors.  Sets *CHANGED to true if DISK itself was
+   modified.  Returns true if successful, false if the disk filled
+   up, in which case some of the sectors may have been added. */
+static bool
+extent_grow (struct inode_disk *disk, block_sector_t cnt,
+             block_sector_t end, bool *changed) 
+{
+  while (cnt > 0)
+    {
+      block_sector_t start, run, i;
+
+      if (end != 0 && free_map_allocate_at (end))
+        {
+          start = end;
+          for (run = 1; run < cnt && free_map_allocate_at (end + run); run++)
+            continue;
+        }
+      else
+        {
+          for (run = cnt; !free_map_allocate (run, &start); run /= 2)
+            if (run == 1)
+              return false;
+        }
+
+      for (i = 0; i < run; i++)
+        {
+          struct cache_block *b = cache_lock (start + i, CACHE_EXCLUSIVE);
+          cache_zero (b);
+          cache_unlock (b, CACHE_EXCLUSIVE);
+        }
+      if (!extent_add (disk, start, run, changed))
+        {
+          for (i = 0; i < run; i++)
+            cache_free (start + i);
+          free_map_release (start, run);
+          return false;
+        }
+
+      end = start + run;
+      cnt -= run;
+    }
+  return true;
+}
+
+/* Returns the sector that holds data sector IDX, counting from
+   0, of the INODE_EXTENTS file described by DISK.  If IDX is
+   past the last extent and ALLOCATE is true, first grows the file
+   through IDX and sets *CHANGED to true if DISK itself was
+   modified.  Returns 0 if IDX is past the last extent and the
+   file was not grown. */
+static block_sector_t
+extent_get_sector (struct inode_disk *disk, off_t idx, bool allocate,
+                   bool *changed) 
+{
+  block_sector_t sector, end;
+  off_t mapped;
+
+  ASSERT (idx >= 0);
+  ASSERT (!allocate || changed != NULL);
+
+  sector = extent_find (disk, idx, &mapped, &end);
+  if (sector != 0 || !allocate || idx >= INODE_SPAN / BLOCK_SECTOR_SIZE)
+    return sector;
+
+  extent_grow (disk, idx + 1 - mapped, end, changed);
+  return extent_find (disk, idx, &mapped, &end);
+}
+
+/* Frees the sectors in the first CNT of EXTENTS, stopping at
+   the first unused one. */
+static void
+release_extents (const struct extent *extents, size_t cnt) 
+{
+  size_t i;
+
+  for (i = 0; i < cnt && extents[i].length != 0; i++)
+    {
+      block_sector_t j;
+
+      for (j = 0; j < extents[i].length; j++)
+        cache_free (extents[i].start + j);
+      free_map_release (extents[i].start, extents[i].length);
+    }
+}
+
+/* Frees every data and overflow sector of the INODE_EXTENTS file
+   described by DISK. */
+static void
+extent_release (struct inode_disk *disk) 
+{
+  block_sector_t next = disk->overflow;
+
+  release_extents (disk->extents, INODE_EXTENT_CNT);
+  while (next != 0)
+    {
+      struct cache_block *b = cache_lock (next, CACHE_SHARED);
+      struct extent_overflow *overflow = cache_read (b);
+      block_sector_t sector = next;
+
+      release_extents (overflow->extents, OVERFLOW_EXTENT_CNT);
+      next = overflow->next;
+      cache_unlock (b, CACHE_SHARED);
+
+      cache_free (sector);
+      free_map_release (sector, 1);
+    }
+  memset (disk->extents, 0, sizeof disk->extents);
+  disk->overflow = 0;
+}
+
+/* Returns the sector that holds data sector IDX, counting from
+   0, of the file described by DISK, as indexed_get_sector() or
+   extent_get_sector(). */
+static block_sector_t
+get_data_sector (struct inode_disk *disk, off_t idx, bool allocate,
+                 bool *changed) 
+{
+  if (disk->layout == INODE_EXTENTS)
+    return extent_get_sector (disk, idx, allocate, changed);
+  else
+    return indexed_get_sector (disk, idx, allocate, changed);
+}
+
+/* Frees every sector that holds data for the file described by
+   DISK, or that maps it. */
+static void
+release_data (struct inode_disk *disk) 
+{
+  if (disk->layout == INODE_EXTENTS)
+    extent_release (disk);
+  else
+    indexed_release (disk);
+}
+
+/* Writes DISK, the contents of an inode, to SECTOR. */
+static void
+write_inode_disk (block_sector_t sector, const struct inode_disk *disk) 
+{
+  struct cache_block *b = cache_lock (sector, CACHE_EXCLUSIVE);
+  memcpy (cache_zero (b), disk, BLOCK_SECTOR_SIZE);
+  cache_unlock (b, CACHE_EXCLUSIVE);
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   within INODE, or 0 if INODE has no sector allocated there.
+   Offsets within the direct sectors take no disk access. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+  return get_data_sector (&inode->data, pos / BLOCK_SECTOR_SIZE, false, NULL);
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  open_inodes_lock
+   protects the table and the open_cnt member of each inode in
+   it. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+/* Number of inode_open() calls that found the inode already
+   open and that had to read it from the buffer cache.  Protected
+   by open_inodes_lock. */
+static long long open_hits, open_misses;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+
+/* Cache of `struct inode's. */
+static struct kmem_cache *inode_cache;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("can't create open inode table");
+  lock_init (&open_inodes_lock);
+  inode_cache = kmem_cache_create ("inode", sizeof (struct inode), NULL);
+}
+
+/* Returns a hash value for the inode containing E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
+
+/* Returns true if inode A's sector precedes inode B's. */
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct inode *a = hash_entry (a_, struct inode, elem);
+  const struct inode *b = hash_entry (b_, struct inode, elem);
+  return a->sector < b->sector;
+}
+
+/* Returns the open inode for SECTOR, after incrementing its
+   open count, or a null pointer if it is not open.
+   open_inodes_lock must be held. */
+static struct inode *
+find_open_inode (block_sector_t sector) 
+{
+  struct inode key;
+  struct hash_elem *e;
+  struct inode *inode;
+
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e == NULL)
+    return NULL;
+  inode = hash_entry (e, struct inode, elem);
+  inode->open_cnt++;
+  return inode;
+}
+
+/* Prints open inode table statistics. */
+void
+inode_print_stats (void) 
+{
+  printf ("Open inodes: %lld hits, %lld misses\n", open_hits, open_misses);
 }
 
-/* Initializes an inode with LENGTH bytes of data and
-   writes the new inode to sector SECTOR on the file system
-   device.
+/* Makes inodes created from now on use LAYOUT. */
+void
+inode_set_default_layout (enum inode_layout layout) 
+{
+  ASSERT (layout == INODE_INDEXED || layout == INODE_EXTENTS);
+  default_layout = layout;
+}
+
+/* Returns the layout of INODE's data. */
+enum inode_layout
+inode_get_layout (const struct inode *inode) 
+{
+  return inode->data.layout;
+}
+
+/* Initializes an inode with LENGTH bytes of data, all zeros,
+   and writes the new inode to sector SECTOR on the file system
+   device.  The inode is a directory if IS_DIR is true, otherwise
+   an ordinary file.  The data sectors are allocated now; sectors
+   added later by writing past the end of file are allocated only
+   as they are written.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -84,22 +686,29 @@ inode_create (block_sector_t sector, off_t length)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
+      off_t sectors = bytes_to_sectors (length);
+      bool changed = false;
+      off_t i;
+
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
+      disk_inode->layout = default_layout;
+      disk_inode->is_dir = is_dir;
+      success = length <= INODE_SPAN;
+
+      /* Asking for the last sector first gives a file with
+         extents all its sectors at once, in as few runs as
+         possible. */
+      if (success && sectors > 0 && disk_inode->layout == INODE_EXTENTS)
+        success = get_data_sector (disk_inode, sectors - 1, true,
+                                   &changed) != 0;
+      for (i = 0; success && i < sectors; i++)
+        success = get_data_sector (disk_inode, i, true, &changed) != 0;
+
+      if (success)
+        write_inode_disk (sector, disk_inode);
+      else
+        release_data (disk_inode);
       free (disk_inode);
     }
   return success;
@@ -111,33 +720,52 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
-  struct inode *inode;
+  struct inode *inode, *other;
+  struct cache_block *b;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
-    {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
-    }
+  lock_acquire (&open_inodes_lock);
+  inode = find_open_inode (sector);
+  if (inode != NULL)
+    open_hits++;
+  else
+    open_misses++;
+  lock_release (&open_inodes_lock);
+  if (inode != NULL)
+    return inode;
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = kmem_cache_alloc (inode_cache);
   if (inode == NULL)
     return NULL;
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize, reading the inode without holding
+     open_inodes_lock. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->read_end = 0;
+  inode->readahead_end = 0;
+  rwlock_init (&inode->lock);
+  lock_init (&inode->extend_lock);
+  rwlock_init (&inode->dir_lock);
+  b = cache_lock (inode->sector, CACHE_SHARED);
+  memcpy (&inode->data, cache_read (b), BLOCK_SECTOR_SIZE);
+  cache_unlock (b, CACHE_SHARED);
+
+  /* Add it to the table, unless another thread opened the same
+     inode meanwhile, in which case use that one instead. */
+  lock_acquire (&open_inodes_lock);
+  other = find_open_inode (sector);
+  if (other == NULL)
+    hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+  if (other != NULL)
+    {
+      kmem_cache_free (inode_cache, inode);
+      inode = other;
+    }
   return inode;
 }
 
@@ -146,7 +774,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -157,31 +789,60 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
+/* Returns true if INODE is a directory, false if it is an
+   ordinary file. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return inode->data.is_dir != 0;
+}
+
+/* Returns the lock that directory.c uses to protect the entries
+   of INODE, which must be a directory. */
+struct rwlock *
+inode_get_dir_lock (struct inode *inode)
+{
+  ASSERT (inode_is_dir (inode));
+  return &inode->dir_lock;
+}
+
+/* Returns true if INODE has been removed, false otherwise. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
 /* Closes INODE and writes it to disk.
    If this was the last reference to INODE, frees its memory.
    If INODE was also a removed inode, frees its blocks. */
 void
 inode_close (struct inode *inode) 
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
+          cache_free (inode->sector);
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          release_data (&inode->data);
         }
 
-      free (inode); 
+      kmem_cache_free (inode_cache, inode); 
     }
 }
 
@@ -194,21 +855,49 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Asks the buffer cache to read ahead the READAHEAD_SECTORS
+   sectors of INODE's data that follow byte offset OFFSET, except
+   for those already requested. */
+static void
+readahead (struct inode *inode, off_t offset) 
+{
+  off_t start = ROUND_UP (offset, BLOCK_SECTOR_SIZE);
+  off_t end = start + READAHEAD_SECTORS * BLOCK_SECTOR_SIZE;
+  off_t pos;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  if (start < inode->readahead_end)
+    start = inode->readahead_end;
+  for (pos = start; pos < end; pos += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, pos);
+      if (sector != 0)
+        cache_readahead (sector);
+    }
+  if (end > inode->readahead_end)
+    inode->readahead_end = end;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   If this read starts where the last one ended, also reads
+   ahead the sectors that follow. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  bool sequential = offset == inode->read_end;
 
+  rwlock_acquire_read (&inode->lock);
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
       block_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      struct cache_block *b;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
@@ -220,23 +909,17 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (sector_idx != 0)
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
+          b = cache_lock (sector_idx, CACHE_SHARED);
+          memcpy (buffer + bytes_read,
+                  (uint8_t *) cache_read (b) + sector_ofs, chunk_size);
+          cache_unlock (b, CACHE_SHARED);
         }
-      else 
+      else
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          /* A hole, never written. */
+          memset (buffer + bytes_read, 0, chunk_size);
         }
       
       /* Advance. */
@@ -244,75 +927,123 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+
+  inode->read_end = offset;
+  if (!sequential)
+    inode->readahead_end = 0;
+  else if (bytes_read > 0)
+    readahead (inode, offset);
+  rwlock_release_read (&inode->lock);
 
   return bytes_read;
 }
 
+/* Returns the sector that holds byte offset POS in INODE,
+   allocating it if necessary, or 0 if the disk is full or POS is
+   beyond the largest file size.  The caller must hold INODE's
+   lock shared, which is dropped and retaken exclusively while
+   allocating. */
+static block_sector_t
+write_sector (struct inode *inode, off_t pos) 
+{
+  off_t idx = pos / BLOCK_SECTOR_SIZE;
+  block_sector_t sector = get_data_sector (&inode->data, idx, false, NULL);
+
+  if (sector == 0)
+    {
+      bool changed = false;
+
+      /* Another writer may allocate the same sector while the lock
+         is dropped.  get_data_sector() then returns that one. */
+      rwlock_release_read (&inode->lock);
+      rwlock_acquire_write (&inode->lock);
+      sector = get_data_sector (&inode->data, idx, true, &changed);
+      if (changed)
+        write_inode_disk (inode->sector, &inode->data);
+      rwlock_release_write (&inode->lock);
+      rwlock_acquire_read (&inode->lock);
+    }
+  return sector;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or the largest possible
+   file size is reached.  Writing past end of file extends INODE,
+   leaving a hole between the old end of file and OFFSET if
+   OFFSET is beyond it. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool extending;
 
-  if (inode->deny_write_cnt)
+  if (offset >= INODE_SPAN)
     return 0;
+  if (size > INODE_SPAN - offset)
+    size = INODE_SPAN - offset;
+
+  /* The length only grows, so a write that ends within it now
+     stays within it. */
+  extending = offset + size > inode_length (inode);
+  if (extending)
+    lock_acquire (&inode->extend_lock);
+  rwlock_acquire_read (&inode->lock);
+  if (inode->deny_write_cnt)
+    size = 0;
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      struct cache_block *b;
+      uint8_t *data;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Bytes left in sector, lesser of that and bytes left to
+         write. */
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      int chunk_size = size < sector_left ? size : sector_left;
 
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      /* Find the sector, allocating it if necessary. */
+      sector_idx = write_sector (inode, offset);
+      if (sector_idx == 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      /* If the sector contains data before or after the chunk
+         we're writing, then we need to read in the sector
+         first.  Otherwise we start with a sector of all zeros. */
+      b = cache_lock (sector_idx, CACHE_EXCLUSIVE);
+      if (sector_ofs > 0 || chunk_size < sector_left) 
+        data = cache_read (b);
+      else
+        data = cache_zero (b);
+      memcpy (data + sector_ofs, buffer + bytes_written, chunk_size);
+      cache_dirty (b);
+      cache_unlock (b, CACHE_EXCLUSIVE);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+  rwlock_release_read (&inode->lock);
+
+  /* Extend the file only after its new data is in place, so that
+     readers never see the new length without the data. */
+  if (extending)
+    {
+      if (bytes_written > 0 && offset > inode->data.length)
+        {
+          rwlock_acquire_write (&inode->lock);
+          inode->data.length = offset;
+          write_inode_disk (inode->sector, &inode->data);
+          rwlock_release_write (&inode->lock);
+        }
+      lock_release (&inode->extend_lock);
+    }
 
   return bytes_written;
 }
@@ -322,8 +1053,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->lock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +1065,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
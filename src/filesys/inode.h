@@ -6,12 +6,27 @@
 #include "devices/block.h"
 
 struct bitmap;
+struct inode;
+struct rwlock;
+
+/* Ways of mapping an inode's data to sectors. */
+enum inode_layout
+  {
+    INODE_INDEXED,              /* Direct and indirect sector lists. */
+    INODE_EXTENTS               /* Runs of consecutive sectors. */
+  };
 
 void inode_init (void);
-bool inode_create (block_sector_t, off_t);
+void inode_print_stats (void);
+void inode_set_default_layout (enum inode_layout);
+enum inode_layout inode_get_layout (const struct inode *);
+bool inode_create (block_sector_t, off_t, bool is_dir);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
+bool inode_is_dir (const struct inode *);
+bool inode_is_removed (const struct inode *);
+struct rwlock *inode_get_dir_lock (struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
@@ -8,6 +8,9 @@
    definition but not any others. */
 typedef int32_t off_t;
 
+/* Largest value of an off_t. */
+#define OFF_MAX INT32_MAX
+
 /* Format specifier for printf(), e.g.:
    printf ("offset=%"PROTd"\n", offset); */
 #define PROTd PRId32
@@ -69,6 +69,67 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns an elem_type in which bits FIRST through LAST,
+   inclusive, are set and the rest are clear.  FIRST and LAST are
+   bit positions within an element. */
+static inline elem_type
+range_mask (size_t first, size_t last) 
+{
+  elem_type high = last + 1 < ELEM_BITS
+                   ? ((elem_type) 1 << (last + 1)) - 1 : (elem_type) -1;
+  return high & ~(((elem_type) 1 << first) - 1);
+}
+
+/* Returns element IDX of B, inverted if VALUE is false, so that
+   the bits set to VALUE in B are set in the result. */
+static inline elem_type
+elem_matching (const struct bitmap *b, size_t idx, bool value) 
+{
+  return value ? b->bits[idx] : ~b->bits[idx];
+}
+
+/* Returns the number of set bits in X.
+
+   GCC's __builtin_popcount() compiles into a call to libgcc on
+   i386, which the kernel does not link against, so we count
+   bits in parallel within X instead. */
+static inline int
+popcount (elem_type x) 
+{
+  x = x - ((x >> 1) & 0x55555555);
+  x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+  x = (x + (x >> 4)) & 0x0f0f0f0f;
+  return (x * 0x01010101) >> 24;
+}
+
+/* Returns the index of the first bit in B at or after START and
+   before END that is set to VALUE, or END if there is none.
+   Whole elements with no bits set to VALUE are skipped with a
+   single comparison. */
+static size_t
+find_next (const struct bitmap *b, size_t start, size_t end, bool value) 
+{
+  size_t idx, last_idx;
+  elem_type e;
+
+  if (start >= end)
+    return end;
+
+  idx = elem_idx (start);
+  last_idx = elem_idx (end - 1);
+  e = elem_matching (b, idx, value) & ~(bit_mask (start) - 1);
+  for (;;)
+    {
+      if (idx == last_idx)
+        e &= range_mask (0, (end - 1) % ELEM_BITS);
+      if (e != 0)
+        return idx * ELEM_BITS + __builtin_ctzl (e);
+      if (idx == last_idx)
+        return end;
+      e = elem_matching (b, ++idx, value);
+    }
+}
+
 /* Creation and destruction. */
 
 /* Initializes B to be a bitmap of BIT_CNT bits
@@ -214,18 +275,34 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element of B is updated atomically, but the whole
+   group of bits is not. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  size_t end = start + cnt;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  while (start < end)
+    {
+      size_t idx = elem_idx (start);
+      size_t last = end - start < ELEM_BITS - start % ELEM_BITS
+                    ? (end - 1) % ELEM_BITS : ELEM_BITS - 1;
+      elem_type mask = range_mask (start % ELEM_BITS, last);
+
+      /* Atomic for the same reason as in bitmap_mark() and
+         bitmap_reset(). */
+      if (value)
+        asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+
+      start = idx * ELEM_BITS + last + 1;
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -233,16 +310,24 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t end = start + cnt;
+  size_t value_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
+  while (start < end)
+    {
+      size_t idx = elem_idx (start);
+      size_t last = end - start < ELEM_BITS - start % ELEM_BITS
+                    ? (end - 1) % ELEM_BITS : ELEM_BITS - 1;
+      elem_type e = elem_matching (b, idx, value);
+
+      value_cnt += popcount (e & range_mask (start % ELEM_BITS, last));
+      start = idx * ELEM_BITS + last + 1;
+    }
   return value_cnt;
 }
 
@@ -251,16 +336,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_next (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -299,13 +379,26 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
+  if (cnt == 0)
+    return start;
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+      while (i <= last)
+        {
+          /* Skip to the next bit set to VALUE, then check whether
+             a bit set to !VALUE cuts the group short.  If so,
+             no group can start before the bit after it. */
+          size_t end;
+          i = find_next (b, i, last + 1, value);
+          if (i > last)
+            break;
+          end = find_next (b, i, i + cnt, !value);
+          if (end == i + cnt)
+            return i;
+          i = end + 1;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -28,7 +28,12 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_NULL,                   /* Do nothing, to measure overhead. */
+    SYS_UPTIME,                 /* Report timer ticks since boot. */
+    SYS_SCHED_TRACE             /* Print the scheduler trace. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -182,3 +182,21 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+void
+null_syscall (void) 
+{
+  syscall0 (SYS_NULL);
+}
+
+unsigned
+uptime (void) 
+{
+  return syscall0 (SYS_UPTIME);
+}
+
+void
+sched_trace (void) 
+{
+  syscall0 (SYS_SCHED_TRACE);
+}
@@ -45,4 +45,9 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+void null_syscall (void);
+unsigned uptime (void);
+void sched_trace (void);
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,150 @@
+/* Creates a few hundred threads that repeatedly sleep for short,
+   staggered intervals, then reports how many context switches
+   the scheduler performed to service them.
+
+   The run is done twice: first with sleepers that busy-wait by
+   yielding until their wakeup tick, as timer_sleep() used to,
+   then with timer_sleep() itself.  With busy-waiting, every
+   sleeper is switched to on every tick, so the switch rate grows
+   with the number of sleepers.  With sleepers that block until
+   their wakeup tick, the rate is bounded by the number of
+   wakeups. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Number of sleeper threads. */
+#define SLEEPER_CNT 200
+
+/* Number of ticks each sleeper keeps sleeping for. */
+#define BENCH_TICKS 500
+
+/* Information about the test. */
+struct bench_test 
+  {
+    int64_t end;                /* Tick at which sleepers stop. */
+    bool busy;                  /* Busy-wait instead of blocking? */
+    struct semaphore done;      /* Upped by each finished sleeper. */
+    struct lock wakeup_lock;    /* Protects wakeup_cnt. */
+    int wakeup_cnt;             /* Total number of wakeups. */
+  };
+
+/* Information about an individual sleeper. */
+struct bench_sleeper 
+  {
+    struct bench_test *test;    /* Info shared between all threads. */
+    int duration;               /* Number of ticks to sleep. */
+  };
+
+static long long run_bench (bool busy);
+static void sleeper (void *);
+static void busy_sleep (int64_t ticks);
+
+void
+test_alarm_bench (void) 
+{
+  long long busy_switches, switches;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  msg ("Creating %d threads to sleep for %d ticks.",
+       SLEEPER_CNT, BENCH_TICKS);
+
+  msg ("Busy-waiting sleep:");
+  busy_switches = run_bench (true);
+  msg ("Blocking timer_sleep():");
+  switches = run_bench (false);
+
+  msg ("Blocking made %lld times fewer context switches.",
+       busy_switches / (switches > 0 ? switches : 1));
+  pass ();
+}
+
+/* Runs SLEEPER_CNT sleepers for BENCH_TICKS ticks, busy-waiting
+   if BUSY is true, reports the results, and returns the number
+   of context switches made. */
+static long long
+run_bench (bool busy) 
+{
+  struct bench_test test;
+  struct bench_sleeper *sleepers;
+  int64_t start_ticks, elapsed;
+  long long start_switches, switches;
+  int i;
+
+  sleepers = malloc (sizeof *sleepers * SLEEPER_CNT);
+  if (sleepers == NULL)
+    PANIC ("couldn't allocate memory for test");
+
+  sema_init (&test.done, 0);
+  lock_init (&test.wakeup_lock);
+  test.wakeup_cnt = 0;
+  test.busy = busy;
+
+  start_ticks = timer_ticks ();
+  start_switches = thread_switch_cnt ();
+  test.end = start_ticks + BENCH_TICKS;
+  for (i = 0; i < SLEEPER_CNT; i++) 
+    {
+      struct bench_sleeper *s = &sleepers[i];
+      char name[16];
+
+      s->test = &test;
+      s->duration = i % 8 + 1;
+      snprintf (name, sizeof name, "sleeper %d", i);
+      if (thread_create (name, PRI_DEFAULT, sleeper, s) == TID_ERROR)
+        fail ("couldn't create thread %d", i);
+    }
+
+  for (i = 0; i < SLEEPER_CNT; i++)
+    sema_down (&test.done);
+  elapsed = timer_elapsed (start_ticks);
+  switches = thread_switch_cnt () - start_switches;
+
+  msg ("%d wakeups in %lld ticks.", test.wakeup_cnt, elapsed);
+  msg ("%lld context switches, %lld per second.",
+       switches, switches * TIMER_FREQ / (elapsed > 0 ? elapsed : 1));
+  free (sleepers);
+  return switches;
+}
+
+/* Sleeper thread. */
+static void
+sleeper (void *s_) 
+{
+  struct bench_sleeper *s = s_;
+  struct bench_test *test = s->test;
+  int wakeups = 0;
+
+  while (timer_ticks () < test->end) 
+    {
+      if (test->busy)
+        busy_sleep (s->duration);
+      else
+        timer_sleep (s->duration);
+      wakeups++;
+    }
+
+  lock_acquire (&test->wakeup_lock);
+  test->wakeup_cnt += wakeups;
+  lock_release (&test->wakeup_lock);
+  sema_up (&test->done);
+}
+
+/* Sleeps for approximately TICKS timer ticks by yielding until
+   they have passed, as timer_sleep() did before sleepers were
+   blocked. */
+static void
+busy_sleep (int64_t ticks) 
+{
+  int64_t start = timer_ticks ();
+
+  while (timer_elapsed (start) < ticks)
+    thread_yield ();
+}
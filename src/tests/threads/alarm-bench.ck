@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+my (@switches)
+  = map (/^\(alarm-bench\) (\d+) context switches, \d+ per second\.$/,
+	 @output);
+fail "missing wakeup summaries\n"
+  if grep (/^\(alarm-bench\) \d+ wakeups in \d+ ticks\.$/, @output) != 2;
+fail "missing context switch summaries\n" if @switches != 2;
+fail "blocking sleepers made $switches[1] context switches, "
+  . "not fewer than busy-waiting sleepers' $switches[0]\n"
+  if $switches[1] >= $switches[0];
+fail "missing PASS\n" if !grep (/^\(alarm-bench\) PASS$/, @output);
+pass;
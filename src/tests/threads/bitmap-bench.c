@@ -0,0 +1,117 @@
+/* Times bitmap_scan() and bitmap_count() over a 1M-bit bitmap
+   that is almost entirely set, as a well-used free map would
+   be, against equivalent loops that test one bit at a time
+   with bitmap_test(), and checks that both give the same
+   answers. */
+
+#include <bitmap.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "devices/timer.h"
+
+/* Number of bits in the bitmap. */
+#define BIT_CNT (1024 * 1024)
+
+/* Runs of clear bits are this far apart. */
+#define HOLE_STRIDE 4099
+
+/* Number of times each operation is repeated. */
+#define REPEAT_CNT 4
+
+static size_t slow_scan (const struct bitmap *, size_t start, size_t cnt);
+static size_t slow_count (const struct bitmap *);
+static void report (const char *name, int64_t fast, int64_t slow);
+
+void
+test_bitmap_bench (void) 
+{
+  struct bitmap *b;
+  size_t fast_idx = 0, slow_idx = 0, fast_cnt = 0, slow_cnt = 0;
+  size_t i;
+  int64_t start, fast_ticks, slow_ticks;
+  int r;
+
+  b = bitmap_create (BIT_CNT);
+  if (b == NULL)
+    fail ("couldn't create %d-bit bitmap", BIT_CNT);
+
+  /* Leave runs of 1 to 3 clear bits spaced well apart, and one
+     run of 8 near the end. */
+  bitmap_set_all (b, true);
+  for (i = 0; i + 3 < BIT_CNT; i += HOLE_STRIDE)
+    bitmap_set_multiple (b, i, i % 3 + 1, false);
+  bitmap_set_multiple (b, BIT_CNT - 100, 8, false);
+
+  /* Scan for the run of 8. */
+  start = timer_ticks ();
+  for (r = 0; r < REPEAT_CNT; r++)
+    fast_idx = bitmap_scan (b, 0, 8, false);
+  fast_ticks = timer_elapsed (start);
+
+  start = timer_ticks ();
+  for (r = 0; r < REPEAT_CNT; r++)
+    slow_idx = slow_scan (b, 0, 8);
+  slow_ticks = timer_elapsed (start);
+
+  if (fast_idx != slow_idx || fast_idx != BIT_CNT - 100)
+    fail ("bitmap_scan returned %zu, expected %zu", fast_idx, slow_idx);
+  report ("scan", fast_ticks, slow_ticks);
+
+  /* Count clear bits. */
+  start = timer_ticks ();
+  for (r = 0; r < REPEAT_CNT; r++)
+    fast_cnt = bitmap_count (b, 0, BIT_CNT, false);
+  fast_ticks = timer_elapsed (start);
+
+  start = timer_ticks ();
+  for (r = 0; r < REPEAT_CNT; r++)
+    slow_cnt = slow_count (b);
+  slow_ticks = timer_elapsed (start);
+
+  if (fast_cnt != slow_cnt)
+    fail ("bitmap_count returned %zu, expected %zu", fast_cnt, slow_cnt);
+  report ("count", fast_ticks, slow_ticks);
+
+  bitmap_destroy (b);
+  pass ();
+}
+
+/* Finds the first run of CNT clear bits in B at or after START,
+   one bit at a time. */
+static size_t
+slow_scan (const struct bitmap *b, size_t start, size_t cnt) 
+{
+  size_t i, j;
+
+  for (i = start; i + cnt <= bitmap_size (b); i++) 
+    {
+      for (j = 0; j < cnt; j++)
+        if (bitmap_test (b, i + j))
+          break;
+      if (j == cnt)
+        return i;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Counts the clear bits in B, one bit at a time. */
+static size_t
+slow_count (const struct bitmap *b) 
+{
+  size_t i, cnt = 0;
+
+  for (i = 0; i < bitmap_size (b); i++)
+    if (!bitmap_test (b, i))
+      cnt++;
+  return cnt;
+}
+
+/* Reports timings for operation NAME, which took FAST ticks
+   word at a time and SLOW ticks bit at a time. */
+static void
+report (const char *name, int64_t fast, int64_t slow) 
+{
+  msg ("%s: %d passes over %d bits, %lld ticks by word, "
+       "%lld ticks by bit.", name, REPEAT_CNT, BIT_CNT, fast, slow);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+foreach my $op ('scan', 'count') {
+    fail "missing $op timing\n"
+      if !grep (/^\(bitmap-bench\) $op: \d+ passes over \d+ bits, \d+ ticks by word, \d+ ticks by bit\.$/,
+		@output);
+}
+fail "missing PASS\n" if !grep (/^\(bitmap-bench\) PASS$/, @output);
+pass;
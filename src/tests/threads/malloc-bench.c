@@ -0,0 +1,139 @@
+/* Measures the throughput of malloc() and of an object cache
+   with a constructor, then allocates a large number of blocks
+   of assorted sizes and reports how much of the memory taken
+   from the page allocator actually holds requested bytes.
+
+   Both throughputs are dominated by the allocator's fast path,
+   since each block is freed soon after it is allocated. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
+
+/* Number of allocations in each throughput run. */
+#define OPS_CNT 200000
+
+/* Blocks held at once during the throughput runs. */
+#define WINDOW 64
+
+/* Blocks held at once during the fragmentation run. */
+#define FRAG_CNT 2000
+
+/* Largest block in the fragmentation run. */
+#define FRAG_SIZE_MAX 1500
+
+/* An object with constructed state. */
+struct bench_obj 
+  {
+    struct lock lock;
+    int value;
+  };
+
+static void bench_obj_ctor (void *);
+static unsigned next_random (unsigned *);
+static void report_rate (const char *, int64_t ticks);
+
+void
+test_malloc_bench (void) 
+{
+  static void *blocks[FRAG_CNT];
+  struct kmem_cache *cache;
+  unsigned seed = 1;
+  size_t requested, start_pages, pages;
+  int64_t start;
+  int i;
+
+  /* malloc() throughput, over sizes from 1 to 256 bytes. */
+  for (i = 0; i < WINDOW; i++)
+    blocks[i] = NULL;
+  start = timer_ticks ();
+  for (i = 0; i < OPS_CNT; i++) 
+    {
+      void **slot = &blocks[i % WINDOW];
+      free (*slot);
+      *slot = malloc (next_random (&seed) % 256 + 1);
+      if (*slot == NULL)
+        fail ("malloc failed after %d allocations", i);
+    }
+  report_rate ("malloc", timer_elapsed (start));
+  for (i = 0; i < WINDOW; i++)
+    free (blocks[i]);
+
+  /* Object cache throughput. */
+  cache = kmem_cache_create ("malloc-bench", sizeof (struct bench_obj),
+                             bench_obj_ctor);
+  for (i = 0; i < WINDOW; i++)
+    blocks[i] = NULL;
+  start = timer_ticks ();
+  for (i = 0; i < OPS_CNT; i++) 
+    {
+      void **slot = &blocks[i % WINDOW];
+      struct bench_obj *obj;
+
+      if (*slot != NULL)
+        kmem_cache_free (cache, *slot);
+      *slot = obj = kmem_cache_alloc (cache);
+      if (obj == NULL)
+        fail ("kmem_cache_alloc failed after %d allocations", i);
+      if (obj->value != 42 || obj->lock.holder != NULL)
+        fail ("object %d not in constructed state", i);
+    }
+  report_rate ("kmem_cache", timer_elapsed (start));
+  for (i = 0; i < WINDOW; i++)
+    kmem_cache_free (cache, blocks[i]);
+
+  /* Fragmentation. */
+  requested = 0;
+  start_pages = kmem_page_cnt ();
+  for (i = 0; i < FRAG_CNT; i++) 
+    {
+      size_t size = next_random (&seed) % FRAG_SIZE_MAX + 1;
+      blocks[i] = malloc (size);
+      if (blocks[i] == NULL)
+        fail ("malloc failed after %d allocations", i);
+      requested += size;
+    }
+  pages = kmem_page_cnt () - start_pages;
+  msg ("%d blocks, %zu bytes requested, %zu pages used.",
+       FRAG_CNT, requested, pages);
+  msg ("Utilization: %zu%%.", requested * 100 / (pages * PGSIZE));
+  for (i = 0; i < FRAG_CNT; i++)
+    free (blocks[i]);
+
+  pass ();
+}
+
+/* Constructor for struct bench_obj. */
+static void
+bench_obj_ctor (void *obj_) 
+{
+  struct bench_obj *obj = obj_;
+  lock_init (&obj->lock);
+  obj->value = 42;
+}
+
+/* Returns the next number from a simple linear congruential
+   generator with state *SEED.  The test uses its own generator
+   so that its sequence of sizes is the same on every run. */
+static unsigned
+next_random (unsigned *seed) 
+{
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 16;
+}
+
+/* Reports the rate of OPS_CNT operations of type NAME in TICKS
+   timer ticks. */
+static void
+report_rate (const char *name, int64_t ticks) 
+{
+  if (ticks <= 0)
+    ticks = 1;
+  msg ("%s: %d allocations in %lld ticks, %lld per second.",
+       name, OPS_CNT, ticks, OPS_CNT * TIMER_FREQ / ticks);
+}
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+foreach my $name ('malloc', 'kmem_cache') {
+    fail "missing $name throughput\n"
+      if !grep (/^\(malloc-bench\) $name: \d+ allocations in \d+ ticks, \d+ per second\.$/,
+		@output);
+}
+fail "missing fragmentation summary\n"
+  if !grep (/^\(malloc-bench\) \d+ blocks, \d+ bytes requested, \d+ pages used\.$/,
+	    @output);
+fail "missing utilization\n"
+  if !grep (/^\(malloc-bench\) Utilization: \d+%\.$/, @output);
+fail "missing PASS\n" if !grep (/^\(malloc-bench\) PASS$/, @output);
+pass;
@@ -0,0 +1,86 @@
+/* Allocates and frees multi-page blocks of assorted sizes from
+   the kernel pool, checking that freeing everything coalesces
+   the pool back into the same free blocks it started with, and
+   reports the rate of multi-page allocations. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/palloc.h"
+#include "devices/timer.h"
+
+/* Number of blocks held at once. */
+#define BLOCK_CNT 32
+
+/* Number of allocations in the throughput run. */
+#define OPS_CNT 20000
+
+static void snapshot (size_t cnt[PALLOC_ORDER_CNT]);
+
+void
+test_palloc_bench (void) 
+{
+  size_t before[PALLOC_ORDER_CNT], after[PALLOC_ORDER_CNT];
+  void *blocks[BLOCK_CNT];
+  size_t sizes[BLOCK_CNT];
+  int64_t start, elapsed;
+  int i, order;
+
+  snapshot (before);
+
+  /* Allocate blocks of 1 to 13 pages, then free them in an
+     order unrelated to their addresses. */
+  for (i = 0; i < BLOCK_CNT; i++) 
+    {
+      sizes[i] = i * 7 % 13 + 1;
+      blocks[i] = palloc_get_multiple (0, sizes[i]);
+      if (blocks[i] == NULL)
+        fail ("allocation of %zu pages failed", sizes[i]);
+    }
+  for (i = 0; i < BLOCK_CNT; i++) 
+    {
+      int j = i * 5 % BLOCK_CNT;
+      palloc_free_multiple (blocks[j], sizes[j]);
+    }
+
+  snapshot (after);
+  for (order = 0; order < PALLOC_ORDER_CNT; order++)
+    if (before[order] != after[order])
+      fail ("order %d: %zu free blocks before, %zu after",
+            order, before[order], after[order]);
+  msg ("Free blocks coalesced.");
+
+  /* Throughput. */
+  for (i = 0; i < BLOCK_CNT; i++)
+    blocks[i] = NULL;
+  start = timer_ticks ();
+  for (i = 0; i < OPS_CNT; i++) 
+    {
+      int slot = i % BLOCK_CNT;
+      if (blocks[slot] != NULL)
+        palloc_free_multiple (blocks[slot], sizes[slot]);
+      blocks[slot] = palloc_get_multiple (0, sizes[slot]);
+      if (blocks[slot] == NULL)
+        fail ("allocation %d of %zu pages failed", i, sizes[slot]);
+    }
+  elapsed = timer_elapsed (start);
+  for (i = 0; i < BLOCK_CNT; i++)
+    palloc_free_multiple (blocks[i], sizes[i]);
+  if (elapsed <= 0)
+    elapsed = 1;
+  msg ("%d allocations in %lld ticks, %lld per second.",
+       OPS_CNT, elapsed, OPS_CNT * TIMER_FREQ / elapsed);
+
+  pass ();
+}
+
+/* Stores the number of free blocks of each order in the kernel
+   pool into CNT. */
+static void
+snapshot (size_t cnt[PALLOC_ORDER_CNT]) 
+{
+  int order;
+
+  for (order = 0; order < PALLOC_ORDER_CNT; order++)
+    cnt[order] = palloc_free_block_cnt (0, order);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+fail "free blocks not coalesced\n"
+  if !grep (/^\(palloc-bench\) Free blocks coalesced\.$/, @output);
+fail "missing throughput\n"
+  if !grep (/^\(palloc-bench\) \d+ allocations in \d+ ticks, \d+ per second\.$/,
+	    @output);
+fail "missing PASS\n" if !grep (/^\(palloc-bench\) PASS$/, @output);
+pass;
@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::threads::sched;
+check_sched_bench ("sched-bench-mlfqs");
@@ -0,0 +1,163 @@
+/* Compares the round-robin scheduler with the MLFQS on a mix of
+   CPU-bound and interactive threads.  Run as sched-bench-rr
+   without -mlfqs and as sched-bench-mlfqs with it.
+
+   CPU_THREAD_CNT threads spin for BENCH_SECONDS, counting the
+   timer ticks during which they run, while IO_THREAD_CNT
+   threads repeatedly sleep for one tick and record how late
+   they get to run after their wakeup tick.  At the end, the test
+   reports:
+
+     - Throughput: the total number of ticks received by the
+       CPU-bound threads.
+
+     - Fairness: Jain's fairness index over the CPU-bound
+       threads' ticks, (sum x)**2 / (n * sum x**2), times 1000,
+       so that 1000 means perfectly fair.
+
+     - Responsiveness: the mean and maximum wakeup latency of
+       the interactive threads, in ticks. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define CPU_THREAD_CNT 8
+#define IO_THREAD_CNT 2
+#define BENCH_SECONDS 10
+
+/* Information about the test. */
+struct bench_test 
+  {
+    int64_t start;              /* Tick at which measurement starts. */
+    int64_t end;                /* Tick at which measurement ends. */
+    struct semaphore done;      /* Upped by each finished thread. */
+  };
+
+/* Information about a single thread. */
+struct bench_thread 
+  {
+    struct bench_test *test;    /* Info shared between all threads. */
+    int ticks;                  /* CPU-bound: ticks received. */
+    int wakeups;                /* Interactive: # of wakeups. */
+    int64_t latency_sum;        /* Interactive: total wakeup latency. */
+    int64_t latency_max;        /* Interactive: maximum wakeup latency. */
+  };
+
+static void cpu_thread (void *);
+static void io_thread (void *);
+
+void
+test_sched_bench (void) 
+{
+  struct bench_test test;
+  struct bench_thread cpu[CPU_THREAD_CNT];
+  struct bench_thread io[IO_THREAD_CNT];
+  int64_t sum = 0, sum_sq = 0, latency_sum = 0, latency_max = 0;
+  int wakeups = 0;
+  int i;
+
+  msg ("Scheduler: %s.", thread_mlfqs ? "mlfqs" : "round-robin");
+  msg ("Running %d CPU-bound and %d interactive threads for %d seconds.",
+       CPU_THREAD_CNT, IO_THREAD_CNT, BENCH_SECONDS);
+
+  /* Stay ahead of the threads we create, so that they all start
+     measuring at the same time. */
+  if (thread_mlfqs)
+    thread_set_nice (-20);
+  else
+    thread_set_priority (PRI_MAX);
+
+  sema_init (&test.done, 0);
+  test.start = timer_ticks () + TIMER_FREQ;
+  test.end = test.start + BENCH_SECONDS * TIMER_FREQ;
+  for (i = 0; i < CPU_THREAD_CNT + IO_THREAD_CNT; i++) 
+    {
+      bool is_cpu = i < CPU_THREAD_CNT;
+      struct bench_thread *b = is_cpu ? &cpu[i] : &io[i - CPU_THREAD_CNT];
+      char name[16];
+
+      b->test = &test;
+      b->ticks = b->wakeups = 0;
+      b->latency_sum = b->latency_max = 0;
+      snprintf (name, sizeof name, "%s %d", is_cpu ? "cpu" : "io", i);
+      thread_create (name, PRI_DEFAULT, is_cpu ? cpu_thread : io_thread, b);
+    }
+
+  for (i = 0; i < CPU_THREAD_CNT + IO_THREAD_CNT; i++)
+    sema_down (&test.done);
+
+  for (i = 0; i < CPU_THREAD_CNT; i++) 
+    {
+      sum += cpu[i].ticks;
+      sum_sq += (int64_t) cpu[i].ticks * cpu[i].ticks;
+    }
+  for (i = 0; i < IO_THREAD_CNT; i++) 
+    {
+      wakeups += io[i].wakeups;
+      latency_sum += io[i].latency_sum;
+      if (io[i].latency_max > latency_max)
+        latency_max = io[i].latency_max;
+    }
+
+  msg ("Throughput: %"PRId64" ticks to CPU-bound threads.", sum);
+  msg ("Fairness: %"PRId64" per mille.",
+       sum_sq > 0 ? sum * sum * 1000 / (CPU_THREAD_CNT * sum_sq) : 0);
+  msg ("Wakeup latency: %"PRId64".%02"PRId64" ticks mean, "
+       "%"PRId64" ticks max.",
+       wakeups > 0 ? latency_sum / wakeups : 0,
+       wakeups > 0 ? latency_sum * 100 / wakeups % 100 : 0,
+       latency_max);
+  pass ();
+}
+
+/* CPU-bound thread: spins, counting the ticks it runs in. */
+static void
+cpu_thread (void *b_) 
+{
+  struct bench_thread *b = b_;
+  struct bench_test *test = b->test;
+  int64_t last_time = 0;
+
+  timer_sleep (test->start - timer_ticks ());
+  for (;;) 
+    {
+      int64_t cur_time = timer_ticks ();
+      if (cur_time >= test->end)
+        break;
+      if (cur_time != last_time)
+        b->ticks++;
+      last_time = cur_time;
+    }
+  sema_up (&test->done);
+}
+
+/* Interactive thread: sleeps for a tick at a time, measuring
+   how long after its wakeup tick it actually runs. */
+static void
+io_thread (void *b_) 
+{
+  struct bench_thread *b = b_;
+  struct bench_test *test = b->test;
+
+  timer_sleep (test->start - timer_ticks ());
+  for (;;) 
+    {
+      int64_t wakeup = timer_ticks () + 1;
+      int64_t latency;
+
+      if (wakeup >= test->end)
+        break;
+      timer_sleep (1);
+      latency = timer_ticks () - wakeup;
+      b->latency_sum += latency;
+      if (latency > b->latency_max)
+        b->latency_max = latency;
+      b->wakeups++;
+    }
+  sema_up (&test->done);
+}
@@ -0,0 +1,28 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+# Checks that the output of the sched-bench test named NAME
+# contains a complete benchmark report.
+sub check_sched_bench {
+    my ($name) = @_;
+    our ($test);
+    my (@output) = read_text_file ("$test.output");
+    common_checks ("run", @output);
+    @output = get_core_output ("run", @output);
+
+    my ($scheduler) = $name =~ /-mlfqs$/ ? 'mlfqs' : 'round-robin';
+    fail "wrong scheduler, expected $scheduler\n"
+      if !grep ($_ eq "($name) Scheduler: $scheduler.", @output);
+    fail "missing throughput report\n"
+      if !grep (/^\(\Q$name\E\) Throughput: \d+ ticks/, @output);
+    fail "missing fairness report\n"
+      if !grep (/^\(\Q$name\E\) Fairness: \d+ per mille\.$/, @output);
+    fail "missing wakeup latency report\n"
+      if !grep (/^\(\Q$name\E\) Wakeup latency: [\d.]+ ticks mean/, @output);
+    fail "missing PASS\n" if !grep ($_ eq "($name) PASS", @output);
+    pass;
+}
+
+1;
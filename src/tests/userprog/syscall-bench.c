@@ -0,0 +1,42 @@
+/* Makes null system calls for about a second and reports how
+   many round trips into the kernel and back it made per
+   second. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Timer ticks to run for. */
+#define BENCH_TICKS 100
+
+/* Timer ticks per second, as TIMER_FREQ in devices/timer.h. */
+#define TICKS_PER_SECOND 100
+
+/* Calls made between checks of the time. */
+#define BATCH 1000
+
+void
+test_main (void) 
+{
+  unsigned start, elapsed;
+  long long calls = 0;
+  int i;
+
+  /* Start at a tick boundary. */
+  start = uptime ();
+  while (uptime () == start)
+    continue;
+  start = uptime ();
+
+  do
+    {
+      for (i = 0; i < BATCH; i++)
+        null_syscall ();
+      calls += BATCH;
+      elapsed = uptime () - start;
+    }
+  while (elapsed < BENCH_TICKS);
+
+  msg ("%lld null system calls in %u ticks.", calls, elapsed);
+  msg ("%lld per second.", calls * TICKS_PER_SECOND / elapsed);
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+fail "missing call count\n"
+  if !grep (/^\(syscall-bench\) \d+ null system calls in \d+ ticks\.$/,
+	    @output);
+fail "missing rate\n"
+  if !grep (/^\(syscall-bench\) \d+ per second\.$/, @output);
+fail "missing exit code\n"
+  if !grep ($_ eq 'syscall-bench: exit(0)', @output);
+pass;
@@ -0,0 +1,53 @@
+/* Sweeps a buffer much larger than physical memory, one byte
+   per page, for about ten seconds and reports how many pages it
+   touched per second.  Nearly every touch faults and forces an
+   eviction to swap and a read back from swap, so the rate
+   measures the page fault and swap paths together; the kernel's
+   statistics at shutdown give the exact fault and swap counts.
+   Each sweep also checks the value the previous one left in
+   each page. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (4 * 1024 * 1024)
+#define PAGE_SIZE 4096
+
+/* Timer ticks to run for. */
+#define BENCH_TICKS 1000
+
+/* Timer ticks per second, as TIMER_FREQ in devices/timer.h. */
+#define TICKS_PER_SECOND 100
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  unsigned start, elapsed;
+  long long touches = 0;
+  char pass = 0;
+  size_t i;
+
+  start = uptime ();
+  do
+    {
+      for (i = 0; i < SIZE; i += PAGE_SIZE)
+        {
+          if (buf[i] != pass)
+            fail ("byte %zu is %d, expected %d", i, buf[i], pass);
+          buf[i] = pass + 1;
+        }
+      touches += SIZE / PAGE_SIZE;
+      pass++;
+      elapsed = uptime () - start;
+    }
+  while (elapsed < BENCH_TICKS);
+
+  if (elapsed == 0)
+    elapsed = 1;
+  msg ("%lld pages touched in %d passes in %u ticks.",
+       touches, pass, elapsed);
+  msg ("%lld per second.", touches * TICKS_PER_SECOND / elapsed);
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+fail "missing touch count\n"
+  if !grep (/^\(swap-bench\) \d+ pages touched in \d+ passes in \d+ ticks\.$/,
+	    @output);
+fail "missing rate\n"
+  if !grep (/^\(swap-bench\) \d+ per second\.$/, @output);
+fail "missing exit code\n"
+  if !grep ($_ eq 'swap-bench: exit(0)', @output);
+pass;
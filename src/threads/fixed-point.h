@@ -0,0 +1,73 @@
+#ifndef THREADS_FIXED_POINT_H
+#define THREADS_FIXED_POINT_H
+
+#include <stdint.h>
+
+/* Signed 17.14 fixed-point arithmetic, as used by the
+   multi-level feedback queue scheduler.
+
+   A fixed_t holds a real number x as the integer x * 2**14, so
+   it has 17 bits before the binary point, 14 after, and a sign
+   bit.  Sums and differences of fixed_t values, and products
+   and quotients of a fixed_t and an int, need no special
+   treatment; the functions below cover everything else.  Products
+   and quotients of two fixed_t values go through 64 bits to
+   avoid overflow. */
+typedef int32_t fixed_t;
+
+/* Number of fractional bits. */
+#define FIX_SHIFT 14
+
+/* 1.0 in fixed point. */
+#define FIX_ONE (1 << FIX_SHIFT)
+
+/* Converts integer N to fixed point. */
+static inline fixed_t
+fix_int (int n) 
+{
+  return n * FIX_ONE;
+}
+
+/* Returns N / D as a fixed-point number. */
+static inline fixed_t
+fix_frac (int n, int d) 
+{
+  return fix_int (n) / d;
+}
+
+/* Converts X to an integer, rounding toward zero. */
+static inline int
+fix_trunc (fixed_t x) 
+{
+  return x / FIX_ONE;
+}
+
+/* Converts X to an integer, rounding to nearest. */
+static inline int
+fix_round (fixed_t x) 
+{
+  return x >= 0 ? (x + FIX_ONE / 2) / FIX_ONE : (x - FIX_ONE / 2) / FIX_ONE;
+}
+
+/* Returns X + N. */
+static inline fixed_t
+fix_add_int (fixed_t x, int n) 
+{
+  return x + fix_int (n);
+}
+
+/* Returns X * Y. */
+static inline fixed_t
+fix_mul (fixed_t x, fixed_t y) 
+{
+  return (int64_t) x * y / FIX_ONE;
+}
+
+/* Returns X / Y. */
+static inline fixed_t
+fix_div (fixed_t x, fixed_t y) 
+{
+  return (int64_t) x * FIX_ONE / y;
+}
+
+#endif /* threads/fixed-point.h */
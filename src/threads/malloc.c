@@ -1,86 +1,76 @@
 #include "threads/malloc.h"
 #include <debug.h>
-#include <list.h>
 #include <round.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/palloc.h"
-#include "threads/synch.h"
+#include "threads/slab.h"
 #include "threads/vaddr.h"
 
-/* A simple implementation of malloc().
-
-   The size of each request, in bytes, is rounded up to a power
-   of 2 and assigned to the "descriptor" that manages blocks of
-   that size.  The descriptor keeps a list of free blocks.  If
-   the free list is nonempty, one of its blocks is used to
-   satisfy the request.
-
-   Otherwise, a new page of memory, called an "arena", is
-   obtained from the page allocator (if none is available,
-   malloc() returns a null pointer).  The new arena is divided
-   into blocks, all of which are added to the descriptor's free
-   list.  Then we return one of the new blocks.
+/* A simple implementation of malloc(), on top of the object
+   caches in slab.c.
+
+   The size of each request, in bytes, is rounded up to the
+   nearest of a fixed set of size classes, each served by its own
+   object cache.  The classes are spaced more finely than powers
+   of 2 (roughly four per doubling at the small end), so that a
+   request wastes less memory to rounding, and the largest ones
+   are chosen to divide a slab evenly.  The class for a request
+   is found with a single table lookup.
+
+   We can't handle blocks bigger than about 2 kB this way,
+   because at least two of them must fit in a slab.  We handle
+   those by allocating contiguous pages with the page allocator
+   and sticking the allocation size at the beginning of the
+   allocation, in a header that the slab allocator will not
+   mistake for one of its own. */
+
+/* Size classes, in bytes. */
+static const size_t class_sizes[] =
+  {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1352, 2032,
+  };
+#define CLASS_CNT (sizeof class_sizes / sizeof *class_sizes)
 
-   When we free a block, we add it to its descriptor's free list.
-   But if the arena that the block was in now has no in-use
-   blocks, we remove all of the arena's blocks from the free list
-   and give the arena back to the page allocator.
+/* Largest request served from a size class. */
+#define CLASS_SIZE_MAX 2032
 
-   We can't handle blocks bigger than 2 kB using this scheme,
-   because they're too big to fit in a single page with a
-   descriptor.  We handle those by allocating contiguous pages
-   with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+/* Granularity of the class lookup table. */
+#define CLASS_GRAIN 16
 
-/* Descriptor. */
-struct desc
-  {
-    size_t block_size;          /* Size of each element in bytes. */
-    size_t blocks_per_arena;    /* Number of blocks in an arena. */
-    struct list free_list;      /* List of free blocks. */
-    struct lock lock;           /* Lock. */
-  };
+/* Object cache for each size class. */
+static struct kmem_cache *class_caches[CLASS_CNT];
 
-/* Magic number for detecting arena corruption. */
-#define ARENA_MAGIC 0x9a548eed
+/* Maps DIV_ROUND_UP (size, CLASS_GRAIN) to a class index. */
+static uint8_t class_lookup[CLASS_SIZE_MAX / CLASS_GRAIN + 1];
 
-/* Arena. */
-struct arena 
-  {
-    unsigned magic;             /* Always set to ARENA_MAGIC. */
-    struct desc *desc;          /* Owning descriptor, null for big block. */
-    size_t free_cnt;            /* Free blocks; pages in big block. */
-  };
+/* Magic number for detecting big block corruption. */
+#define BIG_MAGIC 0x9a548eed
 
-/* Free block. */
-struct block 
+/* Header of a big block. */
+struct big_block 
   {
-    struct list_elem free_elem; /* Free list element. */
+    unsigned magic;             /* Always set to BIG_MAGIC. */
+    size_t page_cnt;            /* Number of pages. */
   };
 
-/* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
-static size_t desc_cnt;         /* Number of descriptors. */
+static struct big_block *block_to_big (void *);
 
-static struct arena *block_to_arena (struct block *);
-static struct block *arena_to_block (struct arena *, size_t idx);
-
-/* Initializes the malloc() descriptors. */
+/* Initializes the malloc() size classes. */
 void
 malloc_init (void) 
 {
-  size_t block_size;
+  size_t i, c;
+
+  for (i = 0; i < CLASS_CNT; i++)
+    class_caches[i] = kmem_cache_create ("malloc", class_sizes[i], NULL);
 
-  for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
+  for (i = c = 0; i < sizeof class_lookup; i++)
     {
-      struct desc *d = &descs[desc_cnt++];
-      ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
-      d->block_size = block_size;
-      d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
-      list_init (&d->free_list);
-      lock_init (&d->lock);
+      while (class_sizes[c] < i * CLASS_GRAIN)
+        c++;
+      class_lookup[i] = c;
     }
 }
 
@@ -89,68 +79,33 @@ malloc_init (void)
 void *
 malloc (size_t size) 
 {
-  struct desc *d;
-  struct block *b;
-  struct arena *a;
+  struct big_block *b;
+  size_t page_cnt;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
     return NULL;
 
-  /* Find the smallest descriptor that satisfies a SIZE-byte
+  /* Allocate from the smallest class that satisfies a SIZE-byte
      request. */
-  for (d = descs; d < descs + desc_cnt; d++)
-    if (d->block_size >= size)
-      break;
-  if (d == descs + desc_cnt) 
-    {
-      /* SIZE is too big for any descriptor.
-         Allocate enough pages to hold SIZE plus an arena. */
-      size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
-      a = palloc_get_multiple (0, page_cnt);
-      if (a == NULL)
-        return NULL;
-
-      /* Initialize the arena to indicate a big block of PAGE_CNT
-         pages, and return it. */
-      a->magic = ARENA_MAGIC;
-      a->desc = NULL;
-      a->free_cnt = page_cnt;
-      return a + 1;
-    }
-
-  lock_acquire (&d->lock);
-
-  /* If the free list is empty, create a new arena. */
-  if (list_empty (&d->free_list))
-    {
-      size_t i;
-
-      /* Allocate a page. */
-      a = palloc_get_page (0);
-      if (a == NULL) 
-        {
-          lock_release (&d->lock);
-          return NULL; 
-        }
+  if (size <= CLASS_SIZE_MAX)
+    return kmem_cache_alloc (class_caches[class_lookup[DIV_ROUND_UP (
+                                                size, CLASS_GRAIN)]]);
 
-      /* Initialize arena and add its blocks to the free list. */
-      a->magic = ARENA_MAGIC;
-      a->desc = d;
-      a->free_cnt = d->blocks_per_arena;
-      for (i = 0; i < d->blocks_per_arena; i++) 
-        {
-          struct block *b = arena_to_block (a, i);
-          list_push_back (&d->free_list, &b->free_elem);
-        }
-    }
+  /* SIZE is too big for any class.
+     Allocate enough pages to hold SIZE plus a header. */
+  if (size > SIZE_MAX - sizeof *b)
+    return NULL;
+  page_cnt = DIV_ROUND_UP (size + sizeof *b, PGSIZE);
+  b = palloc_get_multiple (0, page_cnt);
+  if (b == NULL)
+    return NULL;
 
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
-  lock_release (&d->lock);
-  return b;
+  /* Initialize the header to indicate a big block of PAGE_CNT
+     pages, and return it. */
+  b->magic = BIG_MAGIC;
+  b->page_cnt = page_cnt;
+  return b + 1;
 }
 
 /* Allocates and return A times B bytes initialized to zeroes.
@@ -178,11 +133,10 @@ calloc (size_t a, size_t b)
 static size_t
 block_size (void *block) 
 {
-  struct block *b = block;
-  struct arena *a = block_to_arena (b);
-  struct desc *d = a->desc;
-
-  return d != NULL ? d->block_size : PGSIZE * a->free_cnt - pg_ofs (block);
+  if (kmem_owns (block))
+    return kmem_cache_size (kmem_cache_of (block));
+  else
+    return PGSIZE * block_to_big (block)->page_cnt - pg_ofs (block);
 }
 
 /* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
@@ -220,75 +174,31 @@ free (void *p)
 {
   if (p != NULL)
     {
-      struct block *b = p;
-      struct arena *a = block_to_arena (b);
-      struct desc *d = a->desc;
-      
-      if (d != NULL) 
+      if (kmem_owns (p))
         {
-          /* It's a normal block.  We handle it here. */
-
-#ifndef NDEBUG
-          /* Clear the block to help detect use-after-free bugs. */
-          memset (b, 0xcc, d->block_size);
-#endif
-  
-          lock_acquire (&d->lock);
-
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
-
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
-            {
-              size_t i;
-
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
-            }
-
-          lock_release (&d->lock);
+          /* It's a normal block.  Return it to its cache. */
+          kmem_cache_free (kmem_cache_of (p), p);
         }
       else
         {
           /* It's a big block.  Free its pages. */
-          palloc_free_multiple (a, a->free_cnt);
-          return;
+          struct big_block *b = block_to_big (p);
+          b->magic = 0;
+          palloc_free_multiple (b, b->page_cnt);
         }
     }
 }
-
-/* Returns the arena that block B is inside. */
-static struct arena *
-block_to_arena (struct block *b)
-{
-  struct arena *a = pg_round_down (b);
-
-  /* Check that the arena is valid. */
-  ASSERT (a != NULL);
-  ASSERT (a->magic == ARENA_MAGIC);
 
-  /* Check that the block is properly aligned for the arena. */
-  ASSERT (a->desc == NULL
-          || (pg_ofs (b) - sizeof *a) % a->desc->block_size == 0);
-  ASSERT (a->desc != NULL || pg_ofs (b) == sizeof *a);
+/* Returns the header of big block P. */
+static struct big_block *
+block_to_big (void *p)
+{
+  struct big_block *b = pg_round_down (p);
 
-  return a;
-}
+  /* Check that the header is valid. */
+  ASSERT (b != NULL);
+  ASSERT (b->magic == BIG_MAGIC);
+  ASSERT (pg_ofs (p) == sizeof *b);
 
-/* Returns the (IDX - 1)'th block within arena A. */
-static struct block *
-arena_to_block (struct arena *a, size_t idx) 
-{
-  ASSERT (a != NULL);
-  ASSERT (a->magic == ARENA_MAGIC);
-  ASSERT (idx < a->desc->blocks_per_arena);
-  return (struct block *) ((uint8_t *) a
-                           + sizeof *a
-                           + idx * a->desc->block_size);
+  return b;
 }
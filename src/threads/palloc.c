@@ -2,13 +2,14 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/loader.h"
-#include "threads/synch.h"
+#include "threads/interrupt.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -25,12 +26,47 @@
    half to the user pool.  That should be huge overkill for the
    kernel pool, but that's just fine for demonstration purposes. */
 
-/* A memory pool. */
+/* A memory pool.
+
+   Each pool is managed as a binary buddy system (Knuth, TAOCP
+   vol. 1, sec. 2.5).  Free memory is kept as blocks of 2**ORDER
+   pages, each aligned to its size relative to the pool base, on
+   one free list per order.  An allocation of N pages takes a
+   block of the smallest sufficient order, splitting larger
+   blocks as needed, and gives back the unused tail of the block.
+   Freeing a block merges it with its "buddy", the other half of
+   the next larger block, for as long as the buddy is free too.
+   Both take O(log n) time in the size of the pool.
+
+   The used_map bitmap still records which pages are allocated,
+   for checking frees.  The order array records, for the first
+   page of each free block, the block's order, and NOT_FREE for
+   every other page.  Free blocks are linked into their free
+   list through a struct free_block at the start of the block
+   itself.
+
+   A pool's buddy structures are protected by disabling
+   interrupts rather than by a lock, because every operation on
+   them is short and because schedule_tail() frees the pages of a
+   dying thread in the middle of a context switch, where it must
+   not sleep. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
+    uint8_t *order;                     /* Order of each free block. */
     uint8_t *base;                      /* Base of pool. */
+    size_t page_cnt;                    /* Number of pages in pool. */
+    struct list free_lists[PALLOC_ORDER_CNT];  /* Free blocks by order. */
+    size_t free_cnt[PALLOC_ORDER_CNT];         /* Blocks in each free list. */
+  };
+
+/* Marks a page that does not start a free block. */
+#define NOT_FREE 0xff
+
+/* Header of a free block. */
+struct free_block 
+  {
+    struct list_elem elem;              /* Element in free list. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -39,6 +75,9 @@ static struct pool kernel_pool, user_pool;
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t take_block (struct pool *, int order);
+static void release_pages (struct pool *, size_t page_idx, size_t page_cnt);
+static void print_pool_stats (const struct pool *, const char *name);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -61,6 +100,16 @@ palloc_init (size_t user_page_limit)
              user_pages, "user pool");
 }
 
+/* Returns the smallest order whose blocks hold PAGE_CNT pages. */
+static int
+page_cnt_to_order (size_t page_cnt) 
+{
+  int order = 0;
+  while ((size_t) 1 << order < page_cnt)
+    order++;
+  return order;
+}
+
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
@@ -73,13 +122,28 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
   size_t page_idx;
+  int order;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  order = page_cnt_to_order (page_cnt);
+  if (order < PALLOC_ORDER_CNT)
+    {
+      enum intr_level old_level = intr_disable ();
+      page_idx = take_block (pool, order);
+      if (page_idx != BITMAP_ERROR)
+        {
+          /* Give back the part of the block we don't need. */
+          release_pages (pool, page_idx + page_cnt,
+                         ((size_t) 1 << order) - page_cnt);
+          ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+          bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+        }
+      intr_set_level (old_level);
+    }
+  else
+    page_idx = BITMAP_ERROR;
 
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
@@ -119,6 +183,7 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 {
   struct pool *pool;
   size_t page_idx;
+  enum intr_level old_level;
 
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
@@ -137,8 +202,11 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  old_level = intr_disable ();
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  release_pages (pool, page_idx, page_cnt);
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -148,25 +216,183 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Prints statistics about free blocks in each pool. */
+void
+palloc_print_stats (void) 
+{
+  print_pool_stats (&kernel_pool, "Kernel pool");
+  print_pool_stats (&user_pool, "User pool");
+}
+
+/* Returns the number of free blocks of 2**ORDER pages in the
+   user pool, if PAL_USER is set in FLAGS, or the kernel pool
+   otherwise. */
+size_t
+palloc_free_block_cnt (enum palloc_flags flags, int order) 
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+
+  ASSERT (order >= 0 && order < PALLOC_ORDER_CNT);
+  return pool->free_cnt[order];
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
+  /* We'll put the pool's used_map and order array at its base.
+     Calculate the space needed for them and subtract it from
+     the pool's size. */
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t meta_pages = DIV_ROUND_UP (bm_size + page_cnt, PGSIZE);
+  int order;
+
+  if (meta_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
+  page_cnt -= meta_pages;
 
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
   /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->order = (uint8_t *) base + bm_size;
+  memset (p->order, NOT_FREE, page_cnt);
+  p->base = (uint8_t *) base + meta_pages * PGSIZE;
+  p->page_cnt = page_cnt;
+  for (order = 0; order < PALLOC_ORDER_CNT; order++)
+    {
+      list_init (&p->free_lists[order]);
+      p->free_cnt[order] = 0;
+    }
+
+  /* Start with every page free. */
+  release_pages (p, 0, page_cnt);
+}
+
+/* Returns the free block at PAGE_IDX in POOL. */
+static struct free_block *
+idx_to_block (const struct pool *pool, size_t page_idx) 
+{
+  return (struct free_block *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Adds the block of 2**ORDER pages at PAGE_IDX to POOL's free
+   lists, without merging it with its buddy. */
+static void
+push_block (struct pool *pool, size_t page_idx, int order) 
+{
+  ASSERT (page_idx % ((size_t) 1 << order) == 0);
+
+  pool->order[page_idx] = order;
+  list_push_front (&pool->free_lists[order],
+                   &idx_to_block (pool, page_idx)->elem);
+  pool->free_cnt[order]++;
+}
+
+/* Removes the free block of 2**ORDER pages at PAGE_IDX from
+   POOL's free lists. */
+static void
+remove_block (struct pool *pool, size_t page_idx, int order) 
+{
+  ASSERT (pool->order[page_idx] == order);
+
+  pool->order[page_idx] = NOT_FREE;
+  list_remove (&idx_to_block (pool, page_idx)->elem);
+  pool->free_cnt[order]--;
+}
+
+/* Removes a free block of 2**ORDER pages from POOL and returns
+   the index of its first page, splitting a larger block if
+   necessary.  Returns BITMAP_ERROR if no block is large
+   enough.  Interrupts must be off. */
+static size_t
+take_block (struct pool *pool, int order) 
+{
+  struct free_block *b;
+  size_t page_idx;
+  int k;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* Find the smallest free block that is big enough. */
+  for (k = order; k < PALLOC_ORDER_CNT; k++)
+    if (!list_empty (&pool->free_lists[k]))
+      break;
+  if (k >= PALLOC_ORDER_CNT)
+    return BITMAP_ERROR;
+
+  b = list_entry (list_front (&pool->free_lists[k]), struct free_block, elem);
+  page_idx = pg_no (b) - pg_no (pool->base);
+  remove_block (pool, page_idx, k);
+
+  /* Split it, putting the upper halves back on the free
+     lists. */
+  while (k > order)
+    {
+      k--;
+      push_block (pool, page_idx + ((size_t) 1 << k), k);
+    }
+  return page_idx;
+}
+
+/* Frees the block of 2**ORDER pages at PAGE_IDX in POOL,
+   merging it with its buddy as long as the buddy is free.
+   Interrupts must be off. */
+static void
+coalesce_block (struct pool *pool, size_t page_idx, int order) 
+{
+  while (order < PALLOC_ORDER_CNT - 1)
+    {
+      size_t buddy_idx = page_idx ^ ((size_t) 1 << order);
+      if (buddy_idx + ((size_t) 1 << order) > pool->page_cnt
+          || pool->order[buddy_idx] != order)
+        break;
+
+      remove_block (pool, buddy_idx, order);
+      if (buddy_idx < page_idx)
+        page_idx = buddy_idx;
+      order++;
+    }
+  push_block (pool, page_idx, order);
+}
+
+/* Frees the PAGE_CNT pages starting at PAGE_IDX in POOL, as a
+   series of the largest aligned blocks that fit.  Interrupts
+   must be off, except during initialization. */
+static void
+release_pages (struct pool *pool, size_t page_idx, size_t page_cnt) 
+{
+  while (page_cnt > 0)
+    {
+      int order = 0;
+      while (order < PALLOC_ORDER_CNT - 1
+             && page_idx % ((size_t) 2 << order) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+
+      coalesce_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Prints statistics about the free blocks in POOL, naming it
+   NAME. */
+static void
+print_pool_stats (const struct pool *pool, const char *name) 
+{
+  size_t free_pages = 0;
+  int order;
+
+  for (order = 0; order < PALLOC_ORDER_CNT; order++)
+    free_pages += pool->free_cnt[order] << order;
+  printf ("%s: %zu of %zu pages free; free blocks by order:",
+          name, free_pages, pool->page_cnt);
+  for (order = 0; order < PALLOC_ORDER_CNT; order++)
+    if (pool->free_cnt[order] > 0)
+      printf (" %d:%zu", order, pool->free_cnt[order]);
+  printf ("\n");
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -176,7 +402,7 @@ page_from_pool (const struct pool *pool, void *page)
 {
   size_t page_no = pg_no (page);
   size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t end_page = start_page + pool->page_cnt;
 
   return page_no >= start_page && page_no < end_page;
 }
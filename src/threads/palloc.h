@@ -11,10 +11,16 @@ enum palloc_flags
     PAL_USER = 004              /* User page. */
   };
 
+/* Number of block sizes, from 1 page up to
+   2**(PALLOC_ORDER_CNT - 1) pages (64 MB). */
+#define PALLOC_ORDER_CNT 15
+
 void palloc_init (size_t user_page_limit);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+size_t palloc_free_block_cnt (enum palloc_flags, int order);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
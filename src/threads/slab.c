@@ -0,0 +1,433 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A slab allocator, after Bonwick, "The Slab Allocator: An
+   Object-Caching Kernel Memory Allocator" (USENIX 1994), with
+   the per-processor "magazine" layer of Bonwick and Adams,
+   "Magazines and Vmem" (USENIX 2001).
+
+   Each cache manages objects of a single size.  Objects are
+   carved out of slabs, each one page obtained from the page
+   allocator, with a small header at the start of the page.  A
+   slab's free objects are chained through a link word: the
+   first word of the object itself, or, for caches with a
+   constructor, a word just past the end of the object, so that
+   freed objects stay constructed.
+
+   In front of the slabs, each cache has a magazine, an array of
+   up to MAGAZINE_MAX free objects.  kmem_cache_alloc() and
+   kmem_cache_free() only touch the magazine on the fast path,
+   which needs nothing more than interrupts off for a few
+   instructions, the uniprocessor analog of a per-CPU magazine.
+   Only when the magazine is empty (on allocation) or full (on
+   free) do they take the cache's lock and move half a
+   magazine's worth of objects from or to the slabs at once.
+
+   A cache keeps at most one completely free slab around; any
+   other slab that becomes free is returned to the page
+   allocator. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Most objects a magazine can hold. */
+#define MAGAZINE_MAX 32
+
+/* Slab header, at the start of each slab's page. */
+struct slab 
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in cache's slab lists. */
+    size_t in_use;              /* Objects allocated from this slab. */
+    void *free;                 /* First free object, or null. */
+  };
+
+/* Offset of the first object in a slab. */
+#define SLAB_HEADER_SIZE ROUND_UP (sizeof (struct slab), 8)
+
+/* An object cache. */
+struct kmem_cache 
+  {
+    const char *name;           /* Name, for statistics. */
+    size_t size;                /* Object size, as requested. */
+    size_t stride;              /* Bytes between objects in a slab. */
+    size_t link_ofs;            /* Offset of free-list link in object. */
+    size_t objs_per_slab;       /* Objects in each slab. */
+    kmem_ctor_func *ctor;       /* Constructor, or null. */
+
+    /* Magazine.  Accessed with interrupts off. */
+    void *magazine[MAGAZINE_MAX];
+    size_t mag_cnt;             /* Objects in magazine. */
+    size_t mag_cap;             /* Capacity of magazine. */
+
+    /* Slabs.  Accessed with LOCK held. */
+    struct lock lock;
+    struct list partial;        /* Slabs with free and used objects. */
+    struct list full;           /* Slabs with no free objects. */
+    struct slab *empty;         /* A slab with no used objects. */
+    size_t slab_cnt;            /* Number of slabs. */
+  };
+
+/* All the caches. */
+#define CACHE_MAX 32
+static struct kmem_cache caches[CACHE_MAX];
+static size_t cache_cnt;
+static struct lock caches_lock;
+static bool caches_lock_ready;
+
+static void *slabs_get (struct kmem_cache *);
+static void slabs_put (struct kmem_cache *, void *);
+static struct slab *slab_create (struct kmem_cache *);
+static struct slab *obj_to_slab (const void *);
+
+static inline void **
+obj_link (const struct kmem_cache *c, void *obj) 
+{
+  return (void **) ((uint8_t *) obj + c->link_ofs);
+}
+
+/* Creates and returns a cache for objects of SIZE bytes, named
+   NAME for statistics.  If CTOR is nonnull, it is called on each
+   object once, when the object's slab is created.  Panics if too
+   many caches have been created or SIZE is too big to fit two
+   objects per page; use palloc_get_multiple() for big
+   objects. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, kmem_ctor_func *ctor) 
+{
+  struct kmem_cache *c;
+  enum intr_level old_level;
+
+  ASSERT (name != NULL);
+  ASSERT (size > 0);
+
+  /* The first cache is created early, from malloc_init(), by
+     which time locks work. */
+  old_level = intr_disable ();
+  if (!caches_lock_ready)
+    {
+      lock_init (&caches_lock);
+      caches_lock_ready = true;
+    }
+  intr_set_level (old_level);
+
+  lock_acquire (&caches_lock);
+  if (cache_cnt >= CACHE_MAX)
+    PANIC ("too many object caches");
+  c = &caches[cache_cnt++];
+  lock_release (&caches_lock);
+
+  c->name = name;
+  c->size = size;
+  c->ctor = ctor;
+  c->link_ofs = ctor != NULL ? ROUND_UP (size, sizeof (void *)) : 0;
+  c->stride = ROUND_UP (c->link_ofs + (ctor != NULL ? sizeof (void *) : size),
+                        8);
+  if (c->stride < sizeof (void *))
+    c->stride = sizeof (void *);
+  c->objs_per_slab = (PGSIZE - SLAB_HEADER_SIZE) / c->stride;
+  if (c->objs_per_slab < 2)
+    PANIC ("object cache \"%s\": %zu-byte objects too big", name, size);
+
+  /* Let a magazine hold about a page's worth of objects. */
+  c->mag_cnt = 0;
+  c->mag_cap = c->objs_per_slab;
+  if (c->mag_cap > MAGAZINE_MAX)
+    c->mag_cap = MAGAZINE_MAX;
+
+  lock_init (&c->lock);
+  list_init (&c->partial);
+  list_init (&c->full);
+  c->empty = NULL;
+  c->slab_cnt = 0;
+
+  return c;
+}
+
+/* Allocates and returns an object from cache C, or a null
+   pointer if no memory is available.  This function may sleep,
+   so it must not be called within an interrupt handler. */
+void *
+kmem_cache_alloc (struct kmem_cache *c) 
+{
+  enum intr_level old_level;
+  void *obj;
+
+  ASSERT (c != NULL);
+  ASSERT (!intr_context ());
+
+  /* Fast path: take an object from the magazine. */
+  old_level = intr_disable ();
+  if (c->mag_cnt > 0)
+    {
+      obj = c->magazine[--c->mag_cnt];
+      intr_set_level (old_level);
+      return obj;
+    }
+  intr_set_level (old_level);
+
+  /* Slow path: reload half a magazine from the slabs, keeping
+     one more object to return. */
+  lock_acquire (&c->lock);
+  obj = slabs_get (c);
+  if (obj != NULL)
+    {
+      size_t i;
+      for (i = 0; i < c->mag_cap / 2; i++)
+        {
+          void *extra = slabs_get (c);
+          if (extra == NULL)
+            break;
+
+          old_level = intr_disable ();
+          if (c->mag_cnt < c->mag_cap)
+            {
+              c->magazine[c->mag_cnt++] = extra;
+              extra = NULL;
+            }
+          intr_set_level (old_level);
+
+          /* The magazine was refilled by a thread that ran while
+             we were waiting for the lock. */
+          if (extra != NULL)
+            {
+              slabs_put (c, extra);
+              break;
+            }
+        }
+    }
+  lock_release (&c->lock);
+
+  return obj;
+}
+
+/* Returns OBJ, which must have been allocated from cache C, to
+   C.  This function may sleep, so it must not be called within
+   an interrupt handler. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj) 
+{
+  enum intr_level old_level;
+
+  ASSERT (c != NULL);
+  ASSERT (!intr_context ());
+
+  if (obj == NULL)
+    return;
+  ASSERT (obj_to_slab (obj)->cache == c);
+
+#ifndef NDEBUG
+  /* Clear the object to help detect use-after-free bugs.
+     Constructed objects must be kept intact. */
+  if (c->ctor == NULL)
+    memset (obj, 0xcc, c->size);
+#endif
+
+  /* Fast path: put the object in the magazine. */
+  old_level = intr_disable ();
+  if (c->mag_cnt < c->mag_cap)
+    {
+      c->magazine[c->mag_cnt++] = obj;
+      intr_set_level (old_level);
+      return;
+    }
+  intr_set_level (old_level);
+
+  /* Slow path: drain half the magazine back to the slabs, along
+     with OBJ itself. */
+  lock_acquire (&c->lock);
+  slabs_put (c, obj);
+  for (;;)
+    {
+      void *drained = NULL;
+
+      old_level = intr_disable ();
+      if (c->mag_cnt > c->mag_cap / 2)
+        drained = c->magazine[--c->mag_cnt];
+      intr_set_level (old_level);
+
+      if (drained == NULL)
+        break;
+      slabs_put (c, drained);
+    }
+  lock_release (&c->lock);
+}
+
+/* Returns the size of the objects in cache C. */
+size_t
+kmem_cache_size (const struct kmem_cache *c) 
+{
+  return c->size;
+}
+
+/* Returns true if P points into a page owned by an object
+   cache, false otherwise. */
+bool
+kmem_owns (const void *p) 
+{
+  const struct slab *s = pg_round_down (p);
+  return s->magic == SLAB_MAGIC;
+}
+
+/* Returns the cache that object OBJ was allocated from. */
+struct kmem_cache *
+kmem_cache_of (const void *obj) 
+{
+  return obj_to_slab (obj)->cache;
+}
+
+/* Returns the number of pages held by all object caches. */
+size_t
+kmem_page_cnt (void) 
+{
+  size_t i, page_cnt = 0;
+
+  for (i = 0; i < cache_cnt; i++)
+    page_cnt += caches[i].slab_cnt;
+  return page_cnt;
+}
+
+/* Prints statistics for each object cache that holds memory. */
+void
+kmem_print_stats (void) 
+{
+  size_t i;
+
+  for (i = 0; i < cache_cnt; i++)
+    {
+      struct kmem_cache *c = &caches[i];
+      if (c->slab_cnt > 0)
+        printf ("Slab: %s: %zu-byte objects, %zu pages, "
+                "%zu objects per page, %zu in magazine\n",
+                c->name, c->size, c->slab_cnt, c->objs_per_slab,
+                c->mag_cnt);
+    }
+}
+
+/* Takes one free object from C's slabs, creating a new slab if
+   necessary.  Returns a null pointer if no memory is available.
+   C's lock must be held. */
+static void *
+slabs_get (struct kmem_cache *c) 
+{
+  struct slab *s;
+  void *obj;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  if (!list_empty (&c->partial))
+    s = list_entry (list_front (&c->partial), struct slab, elem);
+  else 
+    {
+      if (c->empty != NULL)
+        {
+          s = c->empty;
+          c->empty = NULL;
+        }
+      else
+        {
+          s = slab_create (c);
+          if (s == NULL)
+            return NULL;
+        }
+      list_push_front (&c->partial, &s->elem);
+    }
+
+  obj = s->free;
+  s->free = *obj_link (c, obj);
+  if (++s->in_use == c->objs_per_slab)
+    {
+      list_remove (&s->elem);
+      list_push_front (&c->full, &s->elem);
+    }
+  return obj;
+}
+
+/* Returns OBJ to its slab in cache C, releasing the slab's page
+   if it becomes free and C already has a free slab.  C's lock
+   must be held. */
+static void
+slabs_put (struct kmem_cache *c, void *obj) 
+{
+  struct slab *s = obj_to_slab (obj);
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+  ASSERT (s->cache == c);
+  ASSERT (s->in_use > 0);
+
+  *obj_link (c, obj) = s->free;
+  s->free = obj;
+  if (s->in_use-- == c->objs_per_slab)
+    {
+      /* Was full, now partial. */
+      list_remove (&s->elem);
+      list_push_front (&c->partial, &s->elem);
+    }
+  if (s->in_use == 0)
+    {
+      list_remove (&s->elem);
+      if (c->empty == NULL)
+        c->empty = s;
+      else
+        {
+          s->magic = 0;
+          palloc_free_page (s);
+          c->slab_cnt--;
+        }
+    }
+}
+
+/* Allocates and initializes a new slab for cache C, running C's
+   constructor on each object.  Returns a null pointer if no
+   memory is available. */
+static struct slab *
+slab_create (struct kmem_cache *c) 
+{
+  struct slab *s = palloc_get_page (0);
+  uint8_t *base;
+  size_t i;
+
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->in_use = 0;
+  s->free = NULL;
+
+  /* Chain the objects in address order. */
+  base = (uint8_t *) s + SLAB_HEADER_SIZE;
+  for (i = c->objs_per_slab; i-- > 0; )
+    {
+      void *obj = base + i * c->stride;
+      if (c->ctor != NULL)
+        c->ctor (obj);
+      *obj_link (c, obj) = s->free;
+      s->free = obj;
+    }
+  c->slab_cnt++;
+  return s;
+}
+
+/* Returns the slab that OBJ is inside. */
+static struct slab *
+obj_to_slab (const void *obj) 
+{
+  struct slab *s = pg_round_down (obj);
+
+  /* Check that the slab is valid and OBJ is properly aligned. */
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT ((pg_ofs (obj) - SLAB_HEADER_SIZE) % s->cache->stride == 0);
+
+  return s;
+}
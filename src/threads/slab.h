@@ -0,0 +1,35 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Object caches.
+
+   An object cache hands out fixed-size objects carved from
+   single-page "slabs".  Freed objects go first into a small
+   per-cache "magazine" of ready objects, from which later
+   allocations are served without taking the cache's lock.  See
+   slab.c for details.
+
+   If a cache has a constructor, each object is constructed once,
+   when its slab is created, and objects must be returned to the
+   cache in their constructed state.  This saves re-initializing
+   hot objects, such as those containing locks or lists, on every
+   allocation. */
+
+/* Constructs object OBJ in place. */
+typedef void kmem_ctor_func (void *obj);
+
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+                                      kmem_ctor_func *);
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+size_t kmem_cache_size (const struct kmem_cache *);
+
+bool kmem_owns (const void *);
+struct kmem_cache *kmem_cache_of (const void *);
+size_t kmem_page_cnt (void);
+void kmem_print_stats (void);
+
+#endif /* threads/slab.h */
@@ -29,9 +29,18 @@
 #include "threads/synch.h"
 #include <stdio.h>
 #include <string.h>
+#include "devices/timeout.h"
+#include "devices/timer.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+/* Maximum length of a chain of locks through which a priority
+   donation is propagated, as in a thread waiting for a lock held
+   by a thread waiting for a lock held by a third thread. */
+#define DONATION_DEPTH_MAX 8
+
+static void donate_priority (struct lock *, int priority);
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -101,8 +110,69 @@ sema_try_down (struct semaphore *sema)
   return success;
 }
 
+/* State shared between sema_down_timeout() and its timeout. */
+struct sema_timeout
+  {
+    struct thread *thread;      /* Waiting thread. */
+    bool timed_out;             /* Set when the timeout fires. */
+  };
+
+/* Timeout function for sema_down_timeout().  If the waiter is
+   still blocked on the semaphore, pulls it off the wait list and
+   wakes it up. */
+static void
+sema_timeout_expire (void *st_) 
+{
+  struct sema_timeout *st = st_;
+
+  if (st->thread->status == THREAD_BLOCKED)
+    {
+      list_remove (&st->thread->elem);
+      st->timed_out = true;
+      thread_unblock (st->thread);
+    }
+}
+
+/* Down or "P" operation on a semaphore, giving up after TICKS
+   timer ticks.  Returns true if SEMA was decremented, false if
+   the timeout expired first.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+sema_down_timeout (struct semaphore *sema, int64_t ticks) 
+{
+  struct sema_timeout st;
+  struct timeout timeout;
+  enum intr_level old_level;
+  bool success;
+
+  ASSERT (sema != NULL);
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  st.thread = thread_current ();
+  st.timed_out = false;
+  timeout_init (&timeout, sema_timeout_expire, &st);
+  timeout_add (&timeout, timer_ticks () + ticks);
+  while (sema->value == 0 && !st.timed_out) 
+    {
+      list_push_back (&sema->waiters, &thread_current ()->elem);
+      thread_block ();
+    }
+  timeout_cancel (&timeout);
+  success = sema->value > 0;
+  if (success)
+    sema->value--;
+  intr_set_level (old_level);
+
+  return success;
+}
+
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up the highest-priority thread of those waiting for
+   SEMA, if any.  If that thread has a higher priority than the
+   running thread, the running thread yields to it.
 
    This function may be called from an interrupt handler. */
 void
@@ -114,10 +184,16 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
   if (!list_empty (&sema->waiters)) 
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+    {
+      struct list_elem *e = list_max (&sema->waiters,
+                                      thread_priority_less, NULL);
+      list_remove (e);
+      thread_unblock (list_entry (e, struct thread, elem));
+    }
   sema->value++;
   intr_set_level (old_level);
+
+  thread_check_preemption ();
 }
 
 static void sema_test_helper (void *sema_);
@@ -185,6 +261,11 @@ lock_init (struct lock *lock)
    necessary.  The lock must not already be held by the current
    thread.
 
+   While waiting, the current thread donates its priority to the
+   lock's holder, and onward through any chain of locks that the
+   holder is itself waiting for, so that a lower-priority holder
+   cannot keep it waiting behind unrelated medium-priority work.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
@@ -192,12 +273,28 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
+  if (lock->holder != NULL && !thread_mlfqs)
+    {
+      cur->waiting_lock = lock;
+      donate_priority (lock, cur->priority);
+    }
   sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
+  cur->waiting_lock = NULL;
+  lock->holder = cur;
+  list_push_back (&cur->held_locks, &lock->elem);
+
+  /* Threads still waiting for LOCK now donate to us. */
+  if (!thread_mlfqs && !list_empty (&lock->semaphore.waiters))
+    thread_recompute_priority (cur);
+  intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -209,18 +306,26 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      lock->holder = thread_current ();
+      list_push_back (&lock->holder->held_locks, &lock->elem);
+    }
+  intr_set_level (old_level);
   return success;
 }
 
 /* Releases LOCK, which must be owned by the current thread.
+   Drops any priority donated through LOCK, keeping donations
+   received through other locks still held.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to release a lock within an interrupt
@@ -228,11 +333,42 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock) 
 {
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   lock->holder = NULL;
+  list_remove (&lock->elem);
+  if (!thread_mlfqs)
+    thread_recompute_priority (thread_current ());
   sema_up (&lock->semaphore);
+  intr_set_level (old_level);
+}
+
+/* Donates PRIORITY to the holder of LOCK and, if that holder is
+   itself waiting for a lock, to that lock's holder, and so on,
+   following at most DONATION_DEPTH_MAX locks.  Stops early once
+   a holder already has at least PRIORITY.  Interrupts must be
+   off. */
+static void
+donate_priority (struct lock *lock, int priority) 
+{
+  int depth;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (depth = 0; depth < DONATION_DEPTH_MAX; depth++)
+    {
+      struct thread *holder = lock->holder;
+      if (holder == NULL || holder->priority >= priority)
+        break;
+      thread_donate_priority (holder, priority);
+      lock = holder->waiting_lock;
+      if (lock == NULL)
+        break;
+    }
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -251,8 +387,11 @@ struct semaphore_elem
   {
     struct list_elem elem;              /* List element. */
     struct semaphore semaphore;         /* This semaphore. */
+    struct thread *thread;              /* Thread waiting on it. */
   };
 
+static list_less_func semaphore_elem_less;
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -295,6 +434,7 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
   
   sema_init (&waiter.semaphore, 0);
+  waiter.thread = thread_current ();
   list_push_back (&cond->waiters, &waiter.elem);
   lock_release (lock);
   sema_down (&waiter.semaphore);
@@ -302,7 +442,8 @@ cond_wait (struct condition *cond, struct lock *lock)
 }
 
 /* If any threads are waiting on COND (protected by LOCK), then
-   this function signals one of them to wake up from its wait.
+   this function signals the highest-priority one of them to wake
+   up from its wait.
    LOCK must be held before calling this function.
 
    An interrupt handler cannot acquire a lock, so it does not
@@ -317,8 +458,26 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (lock_held_by_current_thread (lock));
 
   if (!list_empty (&cond->waiters)) 
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
+    {
+      struct list_elem *e = list_max (&cond->waiters,
+                                      semaphore_elem_less, NULL);
+      list_remove (e);
+      sema_up (&list_entry (e, struct semaphore_elem, elem)->semaphore);
+    }
+}
+
+/* Returns true if the thread waiting on semaphore_elem A_ has
+   lower priority than the one waiting on B_, false otherwise. */
+static bool
+semaphore_elem_less (const struct list_elem *a_,
+                     const struct list_elem *b_, void *aux UNUSED) 
+{
+  const struct semaphore_elem *a
+    = list_entry (a_, struct semaphore_elem, elem);
+  const struct semaphore_elem *b
+    = list_entry (b_, struct semaphore_elem, elem);
+
+  return a->thread->priority < b->thread->priority;
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -336,3 +495,94 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes RWLOCK, which is initially held by no one. */
+void
+rwlock_init (struct rwlock *rwlock) 
+{
+  ASSERT (rwlock != NULL);
+
+  lock_init (&rwlock->lock);
+  cond_init (&rwlock->readers_ok);
+  cond_init (&rwlock->writer_ok);
+  rwlock->reader_cnt = 0;
+  rwlock->waiting_writer_cnt = 0;
+  rwlock->writer = false;
+}
+
+/* Acquires RWLOCK for reading, sleeping until no writer holds or
+   is waiting for it.  Other readers may hold it at the same
+   time.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rwlock) 
+{
+  lock_acquire (&rwlock->lock);
+  while (rwlock->writer || rwlock->waiting_writer_cnt > 0)
+    cond_wait (&rwlock->readers_ok, &rwlock->lock);
+  rwlock->reader_cnt++;
+  lock_release (&rwlock->lock);
+}
+
+/* Tries to acquire RWLOCK for reading without sleeping and
+   returns true if successful or false on failure. */
+bool
+rwlock_try_acquire_read (struct rwlock *rwlock) 
+{
+  bool success;
+
+  lock_acquire (&rwlock->lock);
+  success = !rwlock->writer && rwlock->waiting_writer_cnt == 0;
+  if (success)
+    rwlock->reader_cnt++;
+  lock_release (&rwlock->lock);
+
+  return success;
+}
+
+/* Releases RWLOCK, which the current thread must hold for
+   reading. */
+void
+rwlock_release_read (struct rwlock *rwlock) 
+{
+  lock_acquire (&rwlock->lock);
+  ASSERT (rwlock->reader_cnt > 0);
+  if (--rwlock->reader_cnt == 0)
+    cond_signal (&rwlock->writer_ok, &rwlock->lock);
+  lock_release (&rwlock->lock);
+}
+
+/* Acquires RWLOCK for writing, sleeping until no one else holds
+   it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rwlock) 
+{
+  lock_acquire (&rwlock->lock);
+  rwlock->waiting_writer_cnt++;
+  while (rwlock->writer || rwlock->reader_cnt > 0)
+    cond_wait (&rwlock->writer_ok, &rwlock->lock);
+  rwlock->waiting_writer_cnt--;
+  rwlock->writer = true;
+  lock_release (&rwlock->lock);
+}
+
+/* Releases RWLOCK, which the current thread must hold for
+   writing, and lets in the next writer if one is waiting or
+   else all the waiting readers. */
+void
+rwlock_release_write (struct rwlock *rwlock) 
+{
+  lock_acquire (&rwlock->lock);
+  ASSERT (rwlock->writer);
+  rwlock->writer = false;
+  if (rwlock->waiting_writer_cnt > 0)
+    cond_signal (&rwlock->writer_ok, &rwlock->lock);
+  else
+    cond_broadcast (&rwlock->readers_ok, &rwlock->lock);
+  lock_release (&rwlock->lock);
+}
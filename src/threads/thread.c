@@ -7,10 +7,12 @@
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
@@ -20,9 +22,15 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Run queues of processes in THREAD_READY state, that is,
+   processes that are ready to run but not actually running.
+   There is one FIFO queue per priority level. */
+static struct list ready_queues[PRI_MAX + 1];
+
+/* Bit P is set if and only if ready_queues[P] is nonempty, so
+   that the highest-priority ready thread can be found with a
+   single bit scan instead of a search. */
+static uint64_t ready_mask;
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -49,6 +57,36 @@ struct kernel_thread_frame
 static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
+static long long switch_cnt;    /* # of context switches. */
+
+/* Scheduler trace: a ring buffer holding the most recent
+   SCHED_TRACE_SIZE context switches.  Switch number N (counting
+   from 0) is stored in sched_trace[N % SCHED_TRACE_SIZE]. */
+#define SCHED_TRACE_SIZE 256
+struct sched_event 
+  {
+    int64_t tick;               /* Timer tick of the switch. */
+    tid_t prev;                 /* Thread switched away from. */
+    tid_t next;                 /* Thread switched to. */
+    enum sched_reason reason;   /* Why PREV gave up the CPU. */
+  };
+static struct sched_event sched_trace[SCHED_TRACE_SIZE];
+
+/* CPU accounting for one thread, as printed by
+   thread_print_trace(). */
+struct thread_usage 
+  {
+    tid_t tid;                  /* Thread identifier. */
+    char name[16];              /* Thread name. */
+    int64_t run_ticks;          /* Timer ticks spent running. */
+    int64_t wait_ticks;         /* Timer ticks spent ready. */
+    unsigned voluntary;         /* # of times blocked or yielded. */
+    unsigned involuntary;       /* # of times preempted. */
+  };
+
+/* Set when the running thread is about to yield because it was
+   preempted rather than of its own accord. */
+static bool yield_is_preemption;
 
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
@@ -59,17 +97,47 @@ static unsigned thread_ticks;   /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* If true, print each thread's CPU accounting when it exits and
+   dump the scheduler trace at shutdown.
+   Controlled by kernel command-line option "-sched-trace". */
+bool thread_sched_trace;
+
+/* Multi-level feedback queue scheduler. */
+#define PRI_RECALC_TICKS 4      /* # of ticks between priority updates. */
+#define NICE_MIN -20            /* Lowest niceness. */
+#define NICE_MAX 20             /* Highest niceness. */
+static fixed_t load_avg;        /* System load average. */
+static int ready_cnt;           /* # of threads in the run queues. */
+
+/* Threads whose recent_cpu was charged since the last priority
+   update.  Only these can need a new priority between the
+   once-per-second updates of every thread, so only they are
+   visited every PRI_RECALC_TICKS ticks.  Each tick charges at
+   most one thread, so the array cannot overflow. */
+static struct thread *charged[PRI_RECALC_TICKS];
+static int charged_cnt;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *);
+static void set_effective_priority (struct thread *, int priority);
+static struct thread *ready_pop (int priority);
+static int ready_max_priority (void);
+static void mlfqs_tick (struct thread *);
+static int mlfqs_priority (const struct thread *);
+static void mlfqs_update_priority (struct thread *);
+static void mlfqs_update_second (void);
 static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static size_t fill_usage (struct thread_usage *, size_t cnt);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -87,10 +155,13 @@ static tid_t allocate_tid (void);
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = 0; i <= PRI_MAX; i++)
+    list_init (&ready_queues[i]);
   list_init (&all_list);
 
   /* Set up a thread structure for the running thread. */
@@ -125,6 +196,7 @@ thread_tick (void)
   struct thread *t = thread_current ();
 
   /* Update statistics. */
+  t->run_ticks++;
   if (t == idle_thread)
     idle_ticks++;
 #ifdef USERPROG
@@ -134,9 +206,16 @@ thread_tick (void)
   else
     kernel_ticks++;
 
-  /* Enforce preemption. */
-  if (++thread_ticks >= TIME_SLICE)
-    intr_yield_on_return ();
+  if (thread_mlfqs)
+    mlfqs_tick (t);
+
+  /* Enforce preemption, both at the end of a time slice and as
+     soon as a higher-priority thread has become ready. */
+  if (++thread_ticks >= TIME_SLICE || ready_max_priority () > t->priority)
+    {
+      yield_is_preemption = true;
+      intr_yield_on_return ();
+    }
 }
 
 /* Prints thread statistics. */
@@ -145,6 +224,100 @@ thread_print_stats (void)
 {
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  if (thread_sched_trace)
+    thread_print_trace ();
+}
+
+/* Prints the CPU accounting for every live thread, followed by
+   the most recent context switches, oldest first.
+
+   Printing may sleep on the console lock, so the data is first
+   copied out with interrupts off and printed afterward. */
+void
+thread_print_trace (void) 
+{
+  static const char *reason_names[] = {"block", "yield", "preempt", "exit"};
+  struct thread_usage *usage;
+  struct sched_event *events;
+  size_t thread_cnt, i;
+  long long first, last, n;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  thread_cnt = list_size (&all_list);
+  intr_set_level (old_level);
+
+  /* Leave room for threads created while we allocate. */
+  thread_cnt += 8;
+  usage = malloc (thread_cnt * sizeof *usage);
+  events = malloc (SCHED_TRACE_SIZE * sizeof *events);
+  if (usage == NULL || events == NULL)
+    {
+      printf ("Scheduler trace: out of memory\n");
+      free (usage);
+      free (events);
+      return;
+    }
+
+  old_level = intr_disable ();
+  thread_cnt = fill_usage (usage, thread_cnt);
+  last = switch_cnt;
+  first = last > SCHED_TRACE_SIZE ? last - SCHED_TRACE_SIZE : 0;
+  for (n = first; n < last; n++)
+    events[n - first] = sched_trace[n % SCHED_TRACE_SIZE];
+  intr_set_level (old_level);
+
+  for (i = 0; i < thread_cnt; i++)
+    printf ("Thread %d (%s): %lld run ticks, %lld wait ticks, "
+            "%u voluntary and %u involuntary switches\n",
+            usage[i].tid, usage[i].name, usage[i].run_ticks,
+            usage[i].wait_ticks, usage[i].voluntary, usage[i].involuntary);
+
+  printf ("Scheduler trace: last %lld of %lld context switches\n",
+          last - first, last);
+  for (n = 0; n < last - first; n++)
+    printf ("  tick %lld: tid %d -> tid %d (%s)\n",
+            events[n].tick, events[n].prev, events[n].next,
+            reason_names[events[n].reason]);
+
+  free (usage);
+  free (events);
+}
+
+/* Copies the CPU accounting of up to CNT live threads into
+   USAGE[] and returns the number copied.  Interrupts must be
+   off. */
+static size_t
+fill_usage (struct thread_usage *usage, size_t cnt) 
+{
+  struct list_elem *e;
+  size_t i = 0;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&all_list); e != list_end (&all_list) && i < cnt;
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, allelem);
+      usage[i].tid = t->tid;
+      strlcpy (usage[i].name, t->name, sizeof usage[i].name);
+      usage[i].run_ticks = t->run_ticks;
+      usage[i].wait_ticks = t->wait_ticks;
+      usage[i].voluntary = t->voluntary_switches;
+      usage[i].involuntary = t->involuntary_switches;
+      i++;
+    }
+  return i;
+}
+
+/* Returns the number of context switches since boot. */
+long long
+thread_switch_cnt (void) 
+{
+  enum intr_level old_level = intr_disable ();
+  long long cnt = switch_cnt;
+  intr_set_level (old_level);
+  return cnt;
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -159,9 +332,8 @@ thread_print_stats (void)
    scheduled.  Use a semaphore or some other form of
    synchronization if you need to ensure ordering.
 
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3. */
+   If the new thread has a higher priority than the running
+   thread, the running thread yields to it immediately. */
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux) 
@@ -208,6 +380,7 @@ thread_create (const char *name, int priority,
 
   /* Add to run queue. */
   thread_unblock (t);
+  thread_check_preemption ();
 
   return tid;
 }
@@ -245,8 +418,9 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
   t->status = THREAD_READY;
+  t->ready_since = timer_ticks ();
+  ready_push (t);
   intr_set_level (old_level);
 }
 
@@ -294,10 +468,30 @@ thread_exit (void)
   process_exit ();
 #endif
 
+  if (thread_sched_trace)
+    {
+      struct thread *cur = thread_current ();
+      printf ("Thread %d (%s): %lld run ticks, %lld wait ticks, "
+              "%u voluntary and %u involuntary switches\n",
+              cur->tid, cur->name, cur->run_ticks, cur->wait_ticks,
+              cur->voluntary_switches, cur->involuntary_switches);
+    }
+
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
   intr_disable ();
+  if (thread_mlfqs)
+    {
+      /* Make sure mlfqs_tick() will not touch us after we die. */
+      int i;
+      for (i = 0; i < charged_cnt; i++)
+        if (charged[i] == thread_current ())
+          {
+            charged[i] = charged[--charged_cnt];
+            break;
+          }
+    }
   list_remove (&thread_current()->allelem);
   thread_current ()->status = THREAD_DYING;
   schedule ();
@@ -315,13 +509,36 @@ thread_yield (void)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  if (cur != idle_thread) 
-    list_push_back (&ready_list, &cur->elem);
   cur->status = THREAD_READY;
+  cur->ready_since = timer_ticks ();
+  if (cur != idle_thread) 
+    ready_push (cur);
   schedule ();
   intr_set_level (old_level);
 }
 
+/* Yields the CPU if a thread with a higher priority than the
+   running thread is ready to run.  Within an external interrupt
+   handler, the yield happens just before the interrupt returns.
+
+   Call this after making a thread ready, once it is safe for the
+   running thread to be preempted. */
+void
+thread_check_preemption (void) 
+{
+  enum intr_level old_level = intr_disable ();
+  bool preempt = ready_max_priority () > running_thread ()->priority;
+  intr_set_level (old_level);
+
+  if (!preempt)
+    return;
+  yield_is_preemption = true;
+  if (intr_context ())
+    intr_yield_on_return ();
+  else
+    thread_yield ();
+}
+
 /* Invoke function 'func' on all threads, passing along 'aux'.
    This function must be called with interrupts off. */
 void
@@ -339,11 +556,75 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Sets the current thread's base priority to NEW_PRIORITY.  The
+   effective priority stays higher if it is raised by donation.
+   Yields if the current thread no longer has the highest
+   priority. */
 void
 thread_set_priority (int new_priority) 
 {
-  thread_current ()->priority = new_priority;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+  /* The MLFQS computes priorities by itself. */
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
+  cur->base_priority = new_priority;
+  thread_recompute_priority (cur);
+  intr_set_level (old_level);
+
+  thread_check_preemption ();
+}
+
+/* Raises T's effective priority to PRIORITY, on behalf of a
+   thread waiting for a lock that T holds.  Has no effect if T's
+   priority is already at least PRIORITY.  Interrupts must be
+   off. */
+void
+thread_donate_priority (struct thread *t, int priority) 
+{
+  ASSERT (is_thread (t));
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (priority > t->priority)
+    set_effective_priority (t, priority);
+}
+
+/* Recomputes T's effective priority as the higher of its base
+   priority and the priority of every thread waiting for a lock
+   that T holds.  This takes time proportional to the number of
+   such waiters.  Interrupts must be off. */
+void
+thread_recompute_priority (struct thread *t) 
+{
+  int priority = t->base_priority;
+  struct list_elem *l;
+
+  ASSERT (is_thread (t));
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (l = list_begin (&t->held_locks); l != list_end (&t->held_locks);
+       l = list_next (l))
+    {
+      struct lock *lock = list_entry (l, struct lock, elem);
+      struct list *waiters = &lock->semaphore.waiters;
+      struct list_elem *w;
+
+      for (w = list_begin (waiters); w != list_end (waiters);
+           w = list_next (w))
+        {
+          struct thread *waiter = list_entry (w, struct thread, elem);
+          if (waiter->priority > priority)
+            priority = waiter->priority;
+        }
+    }
+
+  if (priority != t->priority)
+    set_effective_priority (t, priority);
 }
 
 /* Returns the current thread's priority. */
@@ -353,37 +634,176 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE and recomputes
+   its priority, yielding if it no longer has the highest
+   priority. */
 void
-thread_set_nice (int nice UNUSED) 
+thread_set_nice (int nice) 
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (NICE_MIN <= nice && nice <= NICE_MAX);
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  if (thread_mlfqs)
+    mlfqs_update_priority (cur);
+  intr_set_level (old_level);
+
+  thread_check_preemption ();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load_avg_100 = fix_round (load_avg * 100);
+  intr_set_level (old_level);
+  return load_avg_100;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int recent_cpu_100 = fix_round (thread_current ()->recent_cpu * 100);
+  intr_set_level (old_level);
+  return recent_cpu_100;
 }
-
+
+/* Multi-level feedback queue scheduler.
+
+   recent_cpu only changes for the running thread between the
+   once-per-second updates, so instead of recomputing every
+   thread's priority every PRI_RECALC_TICKS ticks we recompute
+   only the priorities of the threads charged since the last
+   time.  Once per second, load_avg and every thread's recent_cpu
+   decay together, so every priority is recomputed then; the
+   decay coefficient is computed once for all threads, and a
+   ready thread is moved between run queues only if its priority
+   actually changed. */
+
+/* Charges the running thread CUR for the current tick and
+   performs the periodic MLFQS updates that are due.  Called
+   from thread_tick() in the timer interrupt. */
+static void
+mlfqs_tick (struct thread *cur) 
+{
+  int64_t ticks = timer_ticks ();
+
+  if (cur != idle_thread)
+    {
+      cur->recent_cpu = fix_add_int (cur->recent_cpu, 1);
+      if (charged_cnt == 0 || charged[charged_cnt - 1] != cur)
+        {
+          int i;
+          for (i = 0; i < charged_cnt; i++)
+            if (charged[i] == cur)
+              break;
+          if (i == charged_cnt)
+            charged[charged_cnt++] = cur;
+        }
+    }
+
+  if (ticks % TIMER_FREQ == 0)
+    mlfqs_update_second ();
+  else if (ticks % PRI_RECALC_TICKS == 0)
+    {
+      int i;
+      for (i = 0; i < charged_cnt; i++)
+        mlfqs_update_priority (charged[i]);
+      charged_cnt = 0;
+    }
+}
+
+/* Returns the priority that the MLFQS assigns to T, based on
+   its recent_cpu and nice values. */
+static int
+mlfqs_priority (const struct thread *t) 
+{
+  int priority = fix_trunc (fix_int (PRI_MAX) - t->recent_cpu / 4)
+                 - t->nice * 2;
+
+  if (priority < PRI_MIN)
+    return PRI_MIN;
+  else if (priority > PRI_MAX)
+    return PRI_MAX;
+  else
+    return priority;
+}
+
+/* Recomputes T's priority from its recent_cpu and nice values.
+   Interrupts must be off. */
+static void
+mlfqs_update_priority (struct thread *t) 
+{
+  int priority;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t == idle_thread)
+    return;
+
+  priority = mlfqs_priority (t);
+  if (priority != t->priority)
+    set_effective_priority (t, priority);
+}
+
+/* Updates load_avg, then decays every thread's recent_cpu and
+   recomputes every thread's priority.  Interrupts must be
+   off. */
+static void
+mlfqs_update_second (void) 
+{
+  int ready_threads = ready_cnt;
+  fixed_t twice_load, decay;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (running_thread () != idle_thread)
+    ready_threads++;
+  load_avg = fix_mul (fix_frac (59, 60), load_avg)
+             + fix_frac (1, 60) * ready_threads;
+
+  twice_load = load_avg * 2;
+  decay = fix_div (twice_load, fix_add_int (twice_load, 1));
+  for (e = list_begin (&all_list); e != list_end (&all_list);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, allelem);
+      if (t == idle_thread)
+        continue;
+      t->recent_cpu = fix_add_int (fix_mul (decay, t->recent_cpu), t->nice);
+      mlfqs_update_priority (t);
+    }
+  charged_cnt = 0;
+}
+
+/* Returns true if the thread containing list element A_ (its
+   `elem' member) has lower priority than the one containing B_,
+   false otherwise.  Used with list_max() to pick the
+   highest-priority waiter; ties go to the earliest waiter. */
+bool
+thread_priority_less (const struct list_elem *a_,
+                      const struct list_elem *b_, void *aux UNUSED) 
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+
+  return a->priority < b->priority;
+}
+
 /* Idle thread.  Executes when no other thread is ready to run.
 
    The idle thread is initially put on the ready list by
@@ -467,7 +887,28 @@ init_thread (struct thread *t, const char *name, int priority)
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
+  if (thread_mlfqs)
+    {
+      /* The initial thread starts from zero; every other thread
+         inherits its creator's values. */
+      struct thread *parent = running_thread ();
+      if (t != parent)
+        {
+          t->nice = parent->nice;
+          t->recent_cpu = parent->recent_cpu;
+        }
+      priority = mlfqs_priority (t);
+    }
   t->priority = priority;
+  t->base_priority = priority;
+  list_init (&t->held_locks);
+  t->waiting_lock = NULL;
+#ifdef USERPROG
+  list_init (&t->children);
+#endif
+#ifdef VM
+  list_init (&t->mappings);
+#endif
   t->magic = THREAD_MAGIC;
   list_push_back (&all_list, &t->allelem);
 }
@@ -489,14 +930,100 @@ alloc_frame (struct thread *t, size_t size)
    return a thread from the run queue, unless the run queue is
    empty.  (If the running thread can continue running, then it
    will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+   idle_thread.
+
+   The thread chosen is the one at the front of the queue for the
+   highest priority that has any ready thread. */
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  int priority = ready_max_priority ();
+
+  if (priority < 0)
     return idle_thread;
   else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+    return ready_pop (priority);
+}
+
+/* Appends T, which must be in THREAD_READY state, to the run
+   queue for its priority.  Interrupts must be off. */
+static void
+ready_push (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_mask |= (uint64_t) 1 << t->priority;
+  ready_cnt++;
+}
+
+/* Removes T, which must be in THREAD_READY state, from its run
+   queue.  Interrupts must be off. */
+static void
+ready_remove (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[t->priority]))
+    ready_mask &= ~((uint64_t) 1 << t->priority);
+  ready_cnt--;
+}
+
+/* Sets T's effective priority to PRIORITY, moving T to the
+   matching run queue if it is ready.  Interrupts must be off. */
+static void
+set_effective_priority (struct thread *t, int priority) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
+
+  if (t->status == THREAD_READY && t != idle_thread)
+    {
+      ready_remove (t);
+      t->priority = priority;
+      ready_push (t);
+    }
+  else
+    t->priority = priority;
+}
+
+/* Removes and returns the thread at the front of the run queue
+   for PRIORITY, which must not be empty.  Interrupts must be
+   off. */
+static struct thread *
+ready_pop (int priority) 
+{
+  struct list *queue = &ready_queues[priority];
+  struct thread *t;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (!list_empty (queue));
+
+  t = list_entry (list_pop_front (queue), struct thread, elem);
+  if (list_empty (queue))
+    ready_mask &= ~((uint64_t) 1 << priority);
+  ready_cnt--;
+  return t;
+}
+
+/* Returns the highest priority of any ready thread, or -1 if no
+   thread is ready.  Finds the most significant bit set in
+   ready_mask, one 32-bit half at a time. */
+static int
+ready_max_priority (void) 
+{
+  uint32_t high = ready_mask >> 32;
+  uint32_t low = ready_mask;
+
+  if (high != 0)
+    return 63 - __builtin_clz (high);
+  else if (low != 0)
+    return 31 - __builtin_clz (low);
+  else
+    return -1;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -564,7 +1091,30 @@ schedule (void)
   ASSERT (is_thread (next));
 
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      struct sched_event *e = &sched_trace[switch_cnt % SCHED_TRACE_SIZE];
+      int64_t now = timer_ticks ();
+
+      e->tick = now;
+      e->prev = cur->tid;
+      e->next = next->tid;
+      if (cur->status == THREAD_BLOCKED)
+        e->reason = SCHED_BLOCK;
+      else if (cur->status == THREAD_DYING)
+        e->reason = SCHED_EXIT;
+      else
+        e->reason = yield_is_preemption ? SCHED_PREEMPT : SCHED_YIELD;
+      if (e->reason == SCHED_PREEMPT)
+        cur->involuntary_switches++;
+      else
+        cur->voluntary_switches++;
+      if (next != idle_thread)
+        next->wait_ticks += now - next->ready_since;
+      switch_cnt++;
+
+      prev = switch_threads (cur, next);
+    }
+  yield_is_preemption = false;
   thread_schedule_tail (prev);
 }
 
@@ -4,6 +4,7 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/fixed-point.h"
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -14,6 +15,17 @@ enum thread_status
     THREAD_DYING        /* About to be destroyed. */
   };
 
+/* Reasons for a thread to give up the CPU, as recorded in the
+   scheduler trace. */
+enum sched_reason
+  {
+    SCHED_BLOCK,        /* Blocked, e.g. on a semaphore or lock. */
+    SCHED_YIELD,        /* Yielded voluntarily. */
+    SCHED_PREEMPT,      /* Preempted at the end of its time slice or
+                           by a higher-priority thread. */
+    SCHED_EXIT          /* Exited. */
+  };
+
 /* Thread identifier type.
    You can redefine this to whatever type you like. */
 typedef int tid_t;
@@ -87,15 +99,47 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Priority. */
+    int priority;                       /* Effective priority. */
     struct list_elem allelem;           /* List element for all threads list. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
+    int base_priority;                  /* Priority before donations. */
+    struct list held_locks;             /* Locks held, which may carry
+                                           donated priority. */
+    struct lock *waiting_lock;          /* Lock being waited for. */
+
+    /* Owned by thread.c, for statistics. */
+    int64_t run_ticks;                  /* Timer ticks spent running. */
+    int64_t wait_ticks;                 /* Timer ticks spent ready. */
+    int64_t ready_since;                /* Tick at which last made ready. */
+    unsigned voluntary_switches;        /* # of times blocked or yielded. */
+    unsigned involuntary_switches;      /* # of times preempted. */
+
+    /* Owned by thread.c, used only by the MLFQS. */
+    int nice;                           /* Niceness. */
+    fixed_t recent_cpu;                 /* Recent CPU time received. */
 
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+    struct process *process;            /* Exit record, if a user process. */
+    struct list children;               /* Exit records of children. */
+    struct file **fds;                  /* Open files, indexed by fd. */
+    struct file *executable;            /* Executable, denied writes. */
+    struct dir *cwd;                    /* Current directory, or null
+                                           for the root directory. */
+#endif
+
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash *pages;                 /* Supplemental page table. */
+    void *user_esp;                     /* User stack pointer on last
+                                           entry to the kernel. */
+
+    /* Owned by userprog/process.c. */
+    struct list mappings;               /* Memory-mapped files. */
+    int next_mapid;                     /* Handle for next mapping. */
 #endif
 
     /* Owned by thread.c. */
@@ -107,11 +151,18 @@ struct thread
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/* If true, print each thread's CPU accounting when it exits and
+   dump the scheduler trace at shutdown.
+   Controlled by kernel command-line option "-sched-trace". */
+extern bool thread_sched_trace;
+
 void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
 void thread_print_stats (void);
+void thread_print_trace (void);
+long long thread_switch_cnt (void);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
@@ -125,6 +176,7 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
+void thread_check_preemption (void);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
@@ -132,6 +184,9 @@ void thread_foreach (thread_action_func *, void *);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_donate_priority (struct thread *, int);
+void thread_recompute_priority (struct thread *);
+list_less_func thread_priority_less;
 
 int thread_get_nice (void);
 void thread_set_nice (int);
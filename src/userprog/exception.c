@@ -4,6 +4,10 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -148,6 +152,28 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+#ifdef VM
+  /* A page that is not present may just not have been loaded
+     yet, or be a new stack page.  This applies to faults taken
+     by the kernel on behalf of a system call as well, which use
+     the stack pointer saved by syscall_handler(). */
+  if (user)
+    thread_current ()->user_esp = f->esp;
+  if (not_present && page_in (fault_addr))
+    return;
+#endif
+
+  /* A fault by the kernel on a user address comes from
+     get_user(), put_user(), or get_user_word() in syscall.c,
+     which left the address to resume at in EAX.  Make the
+     access fail by resuming there with -1 in EAX. */
+  if (!user && is_user_vaddr (fault_addr))
+    {
+      f->eip = (void (*) (void)) f->eax;
+      f->eax = 0xffffffff;
+      return;
+    }
+
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
      which fault_addr refers. */
@@ -14,55 +14,151 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* Most words on a command line. */
+#define ARG_MAX 64
+
+/* Information passed from process_execute() to the new
+   process's start_process(). */
+struct exec_info
+  {
+    char *cmd_line;             /* Command line, in its own page. */
+    struct process *process;    /* New process's exit record. */
+    struct dir *cwd;            /* New process's current directory. */
+    struct semaphore loaded;    /* Upped once loading completes. */
+    bool success;               /* Whether loading succeeded. */
+  };
+
+#ifdef VM
+/* A memory-mapped file. */
+struct mapping
+  {
+    struct list_elem elem;      /* Element in thread's `mappings'. */
+    int handle;                 /* Mapping id. */
+    struct file *file;          /* File, reopened for the mapping. */
+    uint8_t *base;              /* Start of memory mapping. */
+    size_t page_cnt;            /* Number of pages mapped. */
+  };
+#endif
 
 static thread_func start_process NO_RETURN;
-static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static bool load (int argc, char *argv[], void (**eip) (void), void **esp);
+static void release_process (struct process *);
+#ifdef VM
+static void unmap (struct mapping *);
+#endif
 
 /* Starts a new thread running a user program loaded from
-   FILENAME.  The new thread may be scheduled (and may even exit)
-   before process_execute() returns.  Returns the new process's
-   thread id, or TID_ERROR if the thread cannot be created. */
+   FILENAME, which may be followed by arguments separated by
+   spaces, and waits for it to finish loading.  Returns the new
+   process's thread id, or TID_ERROR if the thread cannot be
+   created or the program cannot be loaded. */
 tid_t
 process_execute (const char *file_name) 
 {
-  char *fn_copy;
+  struct exec_info info;
+  char name[sizeof ((struct thread *) 0)->name];
   tid_t tid;
 
   /* Make a copy of FILE_NAME.
      Otherwise there's a race between the caller and load(). */
-  fn_copy = palloc_get_page (0);
-  if (fn_copy == NULL)
+  info.cmd_line = palloc_get_page (0);
+  if (info.cmd_line == NULL)
     return TID_ERROR;
-  strlcpy (fn_copy, file_name, PGSIZE);
+  strlcpy (info.cmd_line, file_name, PGSIZE);
+
+  info.process = malloc (sizeof *info.process);
+  if (info.process == NULL)
+    {
+      palloc_free_page (info.cmd_line);
+      return TID_ERROR;
+    }
+  info.process->exit_status = -1;
+  sema_init (&info.process->exited, 0);
+  info.process->ref_cnt = 2;
+  sema_init (&info.loaded, 0);
+  info.cwd = thread_current ()->cwd;
+
+  /* Name the thread after the program, without arguments. */
+  while (*file_name == ' ')
+    file_name++;
+  strlcpy (name, file_name, sizeof name);
+  name[strcspn (name, " ")] = '\0';
 
   /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create (file_name, PRI_DEFAULT, start_process, fn_copy);
+  tid = thread_create (name, PRI_DEFAULT, start_process, &info);
   if (tid == TID_ERROR)
-    palloc_free_page (fn_copy); 
+    {
+      palloc_free_page (info.cmd_line);
+      free (info.process);
+      return TID_ERROR;
+    }
+
+  sema_down (&info.loaded);
+  if (!info.success)
+    {
+      release_process (info.process);
+      return TID_ERROR;
+    }
+  info.process->tid = tid;
+  list_push_back (&thread_current ()->children, &info.process->elem);
   return tid;
 }
 
 /* A thread function that loads a user process and starts it
    running. */
 static void
-start_process (void *file_name_)
+start_process (void *info_)
 {
-  char *file_name = file_name_;
+  struct exec_info *info = info_;
+  struct thread *t = thread_current ();
   struct intr_frame if_;
+  char *argv[ARG_MAX + 1];
+  char *token, *save_ptr;
+  int argc;
   bool success;
 
+  t->process = info->process;
+  t->fds = calloc (FD_MAX, sizeof *t->fds);
+
+  /* Start out in our parent's current directory.  Our parent is
+     waiting for us, so its directory stays open meanwhile. */
+  if (info->cwd != NULL)
+    t->cwd = dir_reopen (info->cwd);
+
+  /* Split the command line into words. */
+  argc = 0;
+  for (token = strtok_r (info->cmd_line, " ", &save_ptr); token != NULL;
+       token = strtok_r (NULL, " ", &save_ptr))
+    {
+      if (argc >= ARG_MAX)
+        break;
+      argv[argc++] = token;
+    }
+  argv[argc] = NULL;
+
   /* Initialize interrupt frame and load executable. */
   memset (&if_, 0, sizeof if_);
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
-  success = load (file_name, &if_.eip, &if_.esp);
+  success = (t->fds != NULL && argc > 0 && token == NULL
+             && load (argc, argv, &if_.eip, &if_.esp));
+
+  /* Let our parent continue.  INFO belongs to it, so we must not
+     touch INFO afterward. */
+  palloc_free_page (info->cmd_line);
+  info->success = success;
+  sema_up (&info->loaded);
 
   /* If load failed, quit. */
-  palloc_free_page (file_name);
   if (!success) 
     thread_exit ();
 
@@ -81,13 +177,28 @@ start_process (void *file_name_)
    exception), returns -1.  If TID is invalid or if it was not a
    child of the calling process, or if process_wait() has already
    been successfully called for the given TID, returns -1
-   immediately, without waiting.
-
-   This function will be implemented in problem 2-2.  For now, it
-   does nothing. */
+   immediately, without waiting. */
 int
-process_wait (tid_t child_tid UNUSED) 
+process_wait (tid_t child_tid) 
 {
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&cur->children); e != list_end (&cur->children);
+       e = list_next (e))
+    {
+      struct process *child = list_entry (e, struct process, elem);
+      if (child->tid == child_tid)
+        {
+          int status;
+
+          sema_down (&child->exited);
+          status = child->exit_status;
+          list_remove (&child->elem);
+          release_process (child);
+          return status;
+        }
+    }
   return -1;
 }
 
@@ -98,6 +209,49 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd;
 
+  if (cur->process != NULL)
+    printf ("%s: exit(%d)\n", cur->name, cur->process->exit_status);
+
+#ifdef VM
+  /* Unmap memory-mapped files, writing back modified pages. */
+  while (!list_empty (&cur->mappings))
+    {
+      struct list_elem *e = list_front (&cur->mappings);
+      unmap (list_entry (e, struct mapping, elem));
+    }
+#endif
+
+  /* Close open files, including the executable, which allows
+     writes to it again, and the current directory. */
+  if (cur->fds != NULL || cur->executable != NULL || cur->cwd != NULL)
+    {
+      int fd;
+
+      if (cur->fds != NULL)
+        for (fd = 0; fd < FD_MAX; fd++)
+          file_close (cur->fds[fd]);
+      file_close (cur->executable);
+      dir_close (cur->cwd);
+      free (cur->fds);
+      cur->fds = NULL;
+      cur->executable = NULL;
+      cur->cwd = NULL;
+    }
+
+  /* Let go of our children's exit records, then tell our parent
+     that we have exited. */
+  while (!list_empty (&cur->children))
+    {
+      struct list_elem *e = list_pop_front (&cur->children);
+      release_process (list_entry (e, struct process, elem));
+    }
+  if (cur->process != NULL)
+    {
+      sema_up (&cur->process->exited);
+      release_process (cur->process);
+      cur->process = NULL;
+    }
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
@@ -110,12 +264,161 @@ process_exit (void)
          directory before destroying the process's page
          directory, or our active page directory will be one
          that's been freed (and cleared). */
+#ifdef VM
+      page_exit ();
+#endif
       cur->pagedir = NULL;
       pagedir_activate (NULL);
       pagedir_destroy (pd);
     }
 }
 
+/* Drops one reference to exit record P, freeing it if that was
+   the last. */
+static void
+release_process (struct process *p) 
+{
+  enum intr_level old_level;
+  bool last;
+
+  old_level = intr_disable ();
+  last = --p->ref_cnt == 0;
+  intr_set_level (old_level);
+
+  if (last)
+    free (p);
+}
+
+/* Adds FILE to the current process's open files and returns its
+   file descriptor, or -1 if too many files are open. */
+int
+process_add_file (struct file *file) 
+{
+  struct file **fds = thread_current ()->fds;
+  int fd;
+
+  for (fd = 2; fd < FD_MAX; fd++)
+    if (fds[fd] == NULL)
+      {
+        fds[fd] = file;
+        return fd;
+      }
+  return -1;
+}
+
+/* Returns the file that the current process has open as FD, or
+   a null pointer if FD is not open. */
+struct file *
+process_get_file (int fd) 
+{
+  struct file **fds = thread_current ()->fds;
+
+  return fd >= 0 && fd < FD_MAX && fds != NULL ? fds[fd] : NULL;
+}
+
+/* Closes file descriptor FD in the current process.  Returns
+   true if successful, false if FD was not open. */
+bool
+process_close_file (int fd) 
+{
+  struct file *file = process_get_file (fd);
+
+  if (file == NULL)
+    return false;
+  thread_current ()->fds[fd] = NULL;
+  file_close (file);
+  return true;
+}
+
+#ifdef VM
+/* Maps FILE into the current process's address space starting
+   at ADDR, which must be page-aligned, and returns the mapping's
+   id, or -1 on failure.  The mapping has its own reopened copy
+   of FILE, so it outlives FILE being closed.  Pages are read in
+   only when touched, and only modified pages are written back,
+   when they are evicted or the mapping is removed. */
+int
+process_mmap (struct file *file, void *addr)
+{
+  struct thread *cur = thread_current ();
+  struct mapping *m;
+  off_t length, ofs;
+
+  length = file_length (file);
+  if (length <= 0 || addr == NULL || pg_ofs (addr) != 0
+      || !is_user_vaddr (addr)
+      || (uintptr_t) length > (uintptr_t) PHYS_BASE - (uintptr_t) addr)
+    return -1;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return -1;
+  m->file = file_reopen (file);
+  if (m->file == NULL)
+    {
+      free (m);
+      return -1;
+    }
+  m->handle = cur->next_mapid++;
+  m->base = addr;
+  m->page_cnt = 0;
+  list_push_front (&cur->mappings, &m->elem);
+
+  for (ofs = 0; ofs < length; ofs += PGSIZE)
+    {
+      struct page *p = page_allocate (m->base + ofs, true);
+      if (p == NULL)
+        {
+          /* Overlaps a page already in use. */
+          unmap (m);
+          return -1;
+        }
+      p->private = false;
+      p->file = m->file;
+      p->file_offset = ofs;
+      p->file_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+      m->page_cnt++;
+    }
+  return m->handle;
+}
+
+/* Removes the current process's memory mapping MAPID, writing
+   back its modified pages.  Returns true if successful, false
+   if there is no such mapping. */
+bool
+process_munmap (int mapid)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&cur->mappings); e != list_end (&cur->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->handle == mapid)
+        {
+          unmap (m);
+          return true;
+        }
+    }
+  return false;
+}
+
+/* Removes mapping M from the current process's address space,
+   writing back its modified pages, and frees it. */
+static void
+unmap (struct mapping *m)
+{
+  size_t i;
+
+  list_remove (&m->elem);
+  for (i = 0; i < m->page_cnt; i++)
+    page_deallocate (m->base + PGSIZE * i);
+  file_close (m->file);
+  free (m);
+}
+#endif
+
 /* Sets up the CPU for running user code in the current
    thread.
    This function is called on every context switch. */
@@ -195,19 +498,21 @@ struct Elf32_Phdr
 #define PF_W 2          /* Writable. */
 #define PF_R 4          /* Readable. */
 
-static bool setup_stack (void **esp);
+static bool setup_stack (int argc, char *argv[], void **esp);
 static bool validate_segment (const struct Elf32_Phdr *, struct file *);
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
                           uint32_t read_bytes, uint32_t zero_bytes,
                           bool writable);
 
-/* Loads an ELF executable from FILE_NAME into the current thread.
+/* Loads an ELF executable from ARGV[0] into the current thread,
+   passing it the ARGC words in ARGV as arguments.
    Stores the executable's entry point into *EIP
    and its initial stack pointer into *ESP.
    Returns true if successful, false otherwise. */
-bool
-load (const char *file_name, void (**eip) (void), void **esp) 
+static bool
+load (int argc, char *argv[], void (**eip) (void), void **esp) 
 {
+  const char *file_name = argv[0];
   struct thread *t = thread_current ();
   struct Elf32_Ehdr ehdr;
   struct file *file = NULL;
@@ -220,6 +525,10 @@ load (const char *file_name, void (**eip) (void), void **esp)
   if (t->pagedir == NULL) 
     goto done;
   process_activate ();
+#ifdef VM
+  if (!page_table_create ())
+    goto done;
+#endif
 
   /* Open executable file. */
   file = filesys_open (file_name);
@@ -302,12 +611,18 @@ load (const char *file_name, void (**eip) (void), void **esp)
     }
 
   /* Set up stack. */
-  if (!setup_stack (esp))
+  if (!setup_stack (argc, argv, esp))
     goto done;
 
   /* Start address. */
   *eip = (void (*) (void)) ehdr.e_entry;
 
+  /* Keep the executable open, and unwritable, for as long as it
+     runs. */
+  file_deny_write (file);
+  t->executable = file;
+  file = NULL;
+
   success = true;
 
  done:
@@ -318,7 +633,10 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
+static bool push_args (uint8_t *kpage, int argc, char *argv[], void **esp);
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -377,6 +695,10 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With virtual memory, the pages are only recorded in the
+   supplemental page table, to be read in by page_in() when the
+   process first touches them.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -396,6 +718,19 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
+#ifdef VM
+      /* Record where the page's contents come from. */
+      struct page *p = page_allocate (upage, writable);
+      if (p == NULL)
+        return false;
+      if (page_read_bytes > 0)
+        {
+          p->file = file;
+          p->file_offset = ofs;
+          p->file_bytes = page_read_bytes;
+        }
+      ofs += page_read_bytes;
+#else
       /* Get a page of memory. */
       uint8_t *kpage = palloc_get_page (PAL_USER);
       if (kpage == NULL)
@@ -415,6 +750,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
           palloc_free_page (kpage);
           return false; 
         }
+#endif
 
       /* Advance. */
       read_bytes -= page_read_bytes;
@@ -425,10 +761,24 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
-   user virtual memory. */
+   user virtual memory, and push the ARGC words in ARGV onto it
+   as arguments to main(), following the 80x86 calling
+   convention. */
 static bool
-setup_stack (void **esp) 
+setup_stack (int argc, char *argv[], void **esp) 
 {
+#ifdef VM
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
+  uint32_t *pd = thread_current ()->pagedir;
+  bool success;
+
+  if (page_allocate (upage, true) == NULL || !page_lock (upage, true))
+    return false;
+
+  success = push_args (pagedir_get_page (pd, upage), argc, argv, esp);
+  page_unlock (upage);
+  return success;
+#else
   uint8_t *kpage;
   bool success = false;
 
@@ -437,13 +787,61 @@ setup_stack (void **esp)
     {
       success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
       if (success)
-        *esp = PHYS_BASE;
+        success = push_args (kpage, argc, argv, esp);
       else
         palloc_free_page (kpage);
     }
   return success;
+#endif
+}
+
+/* Pushes the ARGC words in ARGV onto the stack page KPAGE,
+   which is mapped at the top of user virtual memory, and stores
+   the resulting user stack pointer in *ESP.  Returns false if
+   the arguments do not fit in the page. */
+static bool
+push_args (uint8_t *kpage, int argc, char *argv[], void **esp) 
+{
+  /* Kernel address of the stack top, and the difference between
+     user and kernel addresses within the page. */
+  uint8_t *top = kpage + PGSIZE;
+  uintptr_t delta = (uintptr_t) PHYS_BASE - (uintptr_t) top;
+  uint8_t *sp = top;
+  uint32_t *words;
+  size_t arg_bytes = 0;
+  int i;
+
+  for (i = 0; i < argc; i++)
+    arg_bytes += strlen (argv[i]) + 1;
+  if (ROUND_UP (arg_bytes, sizeof (uint32_t))
+      + (argc + 4) * sizeof (uint32_t) > PGSIZE)
+    return false;
+
+  /* Word strings, from last to first.  Remember each one's user
+     address by overwriting its ARGV entry. */
+  for (i = argc - 1; i >= 0; i--)
+    {
+      size_t len = strlen (argv[i]) + 1;
+      sp -= len;
+      memcpy (sp, argv[i], len);
+      argv[i] = (char *) (sp + delta);
+    }
+
+  /* Word-align, then push argv[argc] (a null pointer), argv[]
+     itself, argv, argc, and a fake return address. */
+  sp = (uint8_t *) ROUND_DOWN ((uintptr_t) sp, sizeof (uint32_t));
+  words = (uint32_t *) sp - (argc + 4);
+  words[0] = 0;
+  words[1] = argc;
+  words[2] = (uintptr_t) (words + 3) + delta;
+  for (i = 0; i <= argc; i++)
+    words[3 + i] = (uintptr_t) argv[i];
+
+  *esp = (uint8_t *) words + delta;
+  return true;
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -463,3 +861,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
@@ -1,11 +1,39 @@
 #ifndef USERPROG_PROCESS_H
 #define USERPROG_PROCESS_H
 
+#include <list.h>
+#include "threads/synch.h"
 #include "threads/thread.h"
 
+/* Most files a process may have open at once, including the
+   console's file descriptors 0 and 1. */
+#define FD_MAX 128
+
+/* Exit record of a user process.
+
+   Shared between the process and its parent, and freed by
+   whichever of the two lets go of it last, so that the parent
+   can still wait for a process that has already exited and the
+   process can exit after its parent has. */
+struct process
+  {
+    tid_t tid;                  /* Process's thread. */
+    int exit_status;            /* Status passed to exit(), or -1. */
+    struct semaphore exited;    /* Upped when the process exits. */
+    struct list_elem elem;      /* Element in parent's `children'. */
+    int ref_cnt;                /* Number of holders: 0, 1, or 2. */
+  };
+
 tid_t process_execute (const char *file_name);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
 
+int process_add_file (struct file *);
+struct file *process_get_file (int fd);
+bool process_close_file (int fd);
+
+int process_mmap (struct file *, void *addr);
+bool process_munmap (int mapid);
+
 #endif /* userprog/process.h */
@@ -1,10 +1,112 @@
 #include "userprog/syscall.h"
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include "userprog/process.h"
+#include "devices/input.h"
+#include "devices/shutdown.h"
+#include "devices/timer.h"
+#include "filesys/directory.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* System calls.
+
+   The user program pushes the system call number and then its
+   arguments, each one 32-bit word, and executes "int $0x30".
+   syscall_handler() copies the number and as many arguments as
+   the call takes off the user stack, and dispatches through
+   syscall_table[], indexed by number.
+
+   User pointers are not checked by looking them up in the page
+   table.  Instead, the kernel simply dereferences them with
+   get_user() and put_user(), below, after checking only that
+   they are below PHYS_BASE.  If the user page is not mapped, the
+   access page-faults, and page_fault() in exception.c makes the
+   access return an error code instead of killing the kernel.  A
+   mapped page thus costs no more to access than it would
+   otherwise.  Buffers passed to read() and write() are checked
+   by touching one byte in each of their pages, after which the
+   file system can access them directly. */
+
+/* A system call handler.  ARGS holds its arguments, as copied
+   from the user stack.  Returns the value for the caller's
+   EAX. */
+typedef int syscall_func (const uint32_t args[]);
+
+/* Most arguments to any system call. */
+#define SYSCALL_ARG_MAX 3
+
+/* A system call. */
+struct syscall 
+  {
+    syscall_func *func;         /* Handler. */
+    int arg_cnt;                /* Number of arguments. */
+  };
+
+static syscall_func sys_halt, sys_exit, sys_exec, sys_wait;
+static syscall_func sys_create, sys_remove, sys_open, sys_filesize;
+static syscall_func sys_read, sys_write, sys_seek, sys_tell, sys_close;
+static syscall_func sys_chdir, sys_mkdir, sys_readdir, sys_isdir;
+static syscall_func sys_inumber;
+#ifdef VM
+static syscall_func sys_mmap, sys_munmap;
+#endif
+static syscall_func sys_null, sys_uptime, sys_sched_trace;
+
+/* System calls, indexed by number.  Missing entries are not
+   implemented. */
+static const struct syscall syscall_table[] = 
+  {
+    [SYS_HALT] = {sys_halt, 0},
+    [SYS_EXIT] = {sys_exit, 1},
+    [SYS_EXEC] = {sys_exec, 1},
+    [SYS_WAIT] = {sys_wait, 1},
+    [SYS_CREATE] = {sys_create, 2},
+    [SYS_REMOVE] = {sys_remove, 1},
+    [SYS_OPEN] = {sys_open, 1},
+    [SYS_FILESIZE] = {sys_filesize, 1},
+    [SYS_READ] = {sys_read, 3},
+    [SYS_WRITE] = {sys_write, 3},
+    [SYS_SEEK] = {sys_seek, 2},
+    [SYS_TELL] = {sys_tell, 1},
+    [SYS_CLOSE] = {sys_close, 1},
+#ifdef VM
+    [SYS_MMAP] = {sys_mmap, 2},
+    [SYS_MUNMAP] = {sys_munmap, 1},
+#endif
+    [SYS_CHDIR] = {sys_chdir, 1},
+    [SYS_MKDIR] = {sys_mkdir, 1},
+    [SYS_READDIR] = {sys_readdir, 2},
+    [SYS_ISDIR] = {sys_isdir, 1},
+    [SYS_INUMBER] = {sys_inumber, 1},
+    [SYS_NULL] = {sys_null, 0},
+    [SYS_UPTIME] = {sys_uptime, 0},
+    [SYS_SCHED_TRACE] = {sys_sched_trace, 0},
+  };
+
+/* Number of entries in syscall_table[]. */
+#define SYSCALL_CNT (sizeof syscall_table / sizeof *syscall_table)
 
 static void syscall_handler (struct intr_frame *);
+static void exit_process (int status) NO_RETURN;
+static void copy_in (void *dst, const void *usrc, size_t size);
+static char *copy_in_string (const char *us);
+static void check_user_buffer (const void *ubuf, size_t size, bool write);
+#ifdef VM
+static void lock_user_buffer (const void *ubuf, size_t size, bool write);
+static void unlock_user_buffer (const void *ubuf, size_t size);
+#endif
+static struct file *get_data_file (int fd);
 
 void
 syscall_init (void) 
@@ -12,9 +114,511 @@ syscall_init (void)
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
+/* System call handler. */
+static void
+syscall_handler (struct intr_frame *f) 
+{
+  uint32_t args[SYSCALL_ARG_MAX];
+  const struct syscall *sc;
+  unsigned nr;
+
+#ifdef VM
+  /* Save the user stack pointer for stack growth, since page
+     faults in the kernel do not have it. */
+  thread_current ()->user_esp = f->esp;
+#endif
+
+  copy_in (&nr, f->esp, sizeof nr);
+  if (nr >= SYSCALL_CNT || syscall_table[nr].func == NULL)
+    exit_process (-1);
+  sc = &syscall_table[nr];
+
+  copy_in (args, (uint32_t *) f->esp + 1, sizeof *args * sc->arg_cnt);
+  f->eax = sc->func (args);
+}
+
+/* Reads a byte at user virtual address UADDR.
+   UADDR must be below PHYS_BASE.
+   Returns the byte value if successful, -1 if a segfault
+   occurred. */
+static inline int
+get_user (const uint8_t *uaddr)
+{
+  int result;
+  asm ("movl $1f, %0; movzbl %1, %0; 1:"
+       : "=&a" (result) : "m" (*uaddr));
+  return result;
+}
+
+/* Writes BYTE to user address UDST.
+   UDST must be below PHYS_BASE.
+   Returns true if successful, false if a segfault occurred. */
+static inline bool
+put_user (uint8_t *udst, uint8_t byte)
+{
+  int error_code;
+  asm ("movl $1f, %0; movb %b2, %1; 1:"
+       : "=&a" (error_code), "=m" (*udst) : "q" (byte));
+  return error_code != -1;
+}
+
+/* Reads a 32-bit word at user virtual address UADDR into *DST.
+   UADDR through UADDR + 3 must be below PHYS_BASE.
+   Returns true if successful, false if a segfault occurred. */
+static inline bool
+get_user_word (const uint32_t *uaddr, uint32_t *dst)
+{
+  int error_code;
+  uint32_t word;
+  asm ("movl $1f, %0; movl %2, %1; movl $0, %0; 1:"
+       : "=&a" (error_code), "=&r" (word) : "m" (*uaddr));
+  *dst = word;
+  return error_code == 0;
+}
+
+/* Returns true if the SIZE bytes starting at UADDR all lie
+   below PHYS_BASE. */
+static bool
+is_user_range (const void *uaddr, size_t size) 
+{
+  uintptr_t start = (uintptr_t) uaddr;
+  return start + size >= start && start + size <= (uintptr_t) PHYS_BASE;
+}
+
+/* Copies SIZE bytes from user address USRC to kernel address
+   DST, a word at a time.  SIZE must be a multiple of 4.
+   Terminates the process if any byte is not valid to read. */
+static void
+copy_in (void *dst_, const void *usrc_, size_t size) 
+{
+  uint32_t *dst = dst_;
+  const uint32_t *usrc = usrc_;
+
+  ASSERT (size % sizeof (uint32_t) == 0);
+  if (!is_user_range (usrc, size))
+    exit_process (-1);
+  for (; size > 0; size -= sizeof (uint32_t))
+    if (!get_user_word (usrc++, dst++))
+      exit_process (-1);
+}
+
+/* Creates a copy of user string US in kernel memory and returns
+   it as a page that must be freed with palloc_free_page().
+   Truncates the string at PGSIZE bytes in size.
+   Terminates the process if US is not valid to read. */
+static char *
+copy_in_string (const char *us) 
+{
+  char *ks;
+  size_t length;
+
+  ks = palloc_get_page (0);
+  if (ks == NULL)
+    exit_process (-1);
+
+  for (length = 0; length < PGSIZE; length++)
+    {
+      int c;
+
+      if (us + length >= (char *) PHYS_BASE
+          || (c = get_user ((const uint8_t *) us + length)) == -1)
+        {
+          palloc_free_page (ks);
+          exit_process (-1);
+        }
+      ks[length] = c;
+      if (c == '\0')
+        return ks;
+    }
+  ks[PGSIZE - 1] = '\0';
+  return ks;
+}
+
+/* Checks that the SIZE bytes at user address UBUF may be read,
+   or written if WRITE is true, by touching one byte in each page
+   that they span.  Terminates the process if not. */
+static void
+check_user_buffer (const void *ubuf, size_t size, bool write) 
+{
+  uint8_t *p = (uint8_t *) ubuf;
+  uint8_t *end = p + size;
+
+  if (size == 0)
+    return;
+  if (!is_user_range (ubuf, size))
+    exit_process (-1);
+  for (; p < end; p = (uint8_t *) pg_round_down (p) + PGSIZE)
+    {
+      int byte = get_user (p);
+      if (byte == -1 || (write && !put_user (p, byte)))
+        exit_process (-1);
+    }
+}
+
+#ifdef VM
+/* Locks the pages spanned by the SIZE bytes at user address
+   UBUF into memory, writable if WRITE is true, so that the file
+   system can access them while holding its own locks without
+   faulting, and so that they are not evicted meanwhile.  The
+   buffer must already have passed check_user_buffer().
+   Terminates the process if a page cannot be locked. */
 static void
-syscall_handler (struct intr_frame *f UNUSED) 
+lock_user_buffer (const void *ubuf, size_t size, bool write) 
 {
-  printf ("system call!\n");
+  uint8_t *start = pg_round_down (ubuf);
+  uint8_t *p;
+
+  if (size == 0)
+    return;
+  for (p = start; p < (uint8_t *) ubuf + size; p += PGSIZE)
+    if (!page_lock (p, write))
+      {
+        /* Exiting frees our pages, which must not be locked. */
+        while (p > start)
+          {
+            p -= PGSIZE;
+            page_unlock (p);
+          }
+        exit_process (-1);
+      }
+}
+
+/* Unlocks the pages locked by lock_user_buffer(). */
+static void
+unlock_user_buffer (const void *ubuf, size_t size) 
+{
+  uint8_t *p;
+
+  if (size == 0)
+    return;
+  for (p = pg_round_down (ubuf); p < (uint8_t *) ubuf + size; p += PGSIZE)
+    page_unlock (p);
+}
+#endif
+
+/* Returns the file open as FD, or a null pointer if FD is not
+   open or is a directory, whose data may only be accessed
+   through readdir(). */
+static struct file *
+get_data_file (int fd) 
+{
+  struct file *file = process_get_file (fd);
+
+  if (file != NULL && inode_is_dir (file_get_inode (file)))
+    return NULL;
+  return file;
+}
+
+/* Terminates the current process with exit code STATUS. */
+static void
+exit_process (int status) 
+{
+  struct thread *cur = thread_current ();
+
+  if (cur->process != NULL)
+    cur->process->exit_status = status;
   thread_exit ();
 }
+
+/* Halt system call. */
+static int
+sys_halt (const uint32_t args[] UNUSED) 
+{
+  shutdown_power_off ();
+}
+
+/* Exit system call. */
+static int
+sys_exit (const uint32_t args[]) 
+{
+  exit_process ((int) args[0]);
+}
+
+/* Exec system call. */
+static int
+sys_exec (const uint32_t args[]) 
+{
+  char *cmd_line = copy_in_string ((const char *) args[0]);
+  tid_t tid = process_execute (cmd_line);
+
+  palloc_free_page (cmd_line);
+  return tid;
+}
+
+/* Wait system call. */
+static int
+sys_wait (const uint32_t args[]) 
+{
+  return process_wait ((tid_t) args[0]);
+}
+
+/* Create system call.  Fails if the initial size does not fit
+   in an off_t. */
+static int
+sys_create (const uint32_t args[]) 
+{
+  char *name = copy_in_string ((const char *) args[0]);
+  unsigned initial_size = args[1];
+  bool success;
+
+  success = (initial_size <= OFF_MAX
+             && filesys_create (name, initial_size));
+  palloc_free_page (name);
+  return success;
+}
+
+/* Remove system call. */
+static int
+sys_remove (const uint32_t args[]) 
+{
+  char *name = copy_in_string ((const char *) args[0]);
+  bool success;
+
+  success = filesys_remove (name);
+  palloc_free_page (name);
+  return success;
+}
+
+/* Open system call. */
+static int
+sys_open (const uint32_t args[]) 
+{
+  char *name = copy_in_string ((const char *) args[0]);
+  struct file *file;
+  int fd = -1;
+
+  file = filesys_open (name);
+  if (file != NULL)
+    {
+      fd = process_add_file (file);
+      if (fd < 0)
+        file_close (file);
+    }
+  palloc_free_page (name);
+  return fd;
+}
+
+/* Filesize system call. */
+static int
+sys_filesize (const uint32_t args[]) 
+{
+  struct file *file = process_get_file (args[0]);
+  int size;
+
+  if (file == NULL)
+    return -1;
+  size = file_length (file);
+  return size;
+}
+
+/* Read system call. */
+static int
+sys_read (const uint32_t args[]) 
+{
+  int fd = args[0];
+  uint8_t *buffer = (uint8_t *) args[1];
+  unsigned size = args[2];
+  struct file *file;
+  int bytes_read;
+
+  check_user_buffer (buffer, size, true);
+  if (fd == STDIN_FILENO)
+    {
+      unsigned i;
+      for (i = 0; i < size; i++)
+        buffer[i] = input_getc ();
+      return size;
+    }
+
+  file = get_data_file (fd);
+  if (file == NULL)
+    return -1;
+#ifdef VM
+  lock_user_buffer (buffer, size, true);
+#endif
+  bytes_read = file_read (file, buffer, size);
+#ifdef VM
+  unlock_user_buffer (buffer, size);
+#endif
+  return bytes_read;
+}
+
+/* Write system call. */
+static int
+sys_write (const uint32_t args[]) 
+{
+  int fd = args[0];
+  const void *buffer = (const void *) args[1];
+  unsigned size = args[2];
+  struct file *file;
+  int bytes_written;
+
+  check_user_buffer (buffer, size, false);
+  if (fd == STDOUT_FILENO)
+    {
+      putbuf (buffer, size);
+      return size;
+    }
+
+  file = get_data_file (fd);
+  if (file == NULL)
+    return -1;
+#ifdef VM
+  lock_user_buffer (buffer, size, false);
+#endif
+  bytes_written = file_write (file, buffer, size);
+#ifdef VM
+  unlock_user_buffer (buffer, size);
+#endif
+  return bytes_written;
+}
+
+/* Seek system call.  A position past the end of the file is
+   allowed; one too big for an off_t is clamped to OFF_MAX. */
+static int
+sys_seek (const uint32_t args[]) 
+{
+  struct file *file = process_get_file (args[0]);
+  unsigned position = args[1];
+
+  if (file != NULL)
+    file_seek (file, position <= OFF_MAX ? position : OFF_MAX);
+  return 0;
+}
+
+/* Tell system call. */
+static int
+sys_tell (const uint32_t args[]) 
+{
+  struct file *file = process_get_file (args[0]);
+  int position;
+
+  if (file == NULL)
+    return -1;
+  position = file_tell (file);
+  return position;
+}
+
+/* Close system call. */
+static int
+sys_close (const uint32_t args[]) 
+{
+  process_close_file (args[0]);
+  return 0;
+}
+
+#ifdef VM
+/* Mmap system call. */
+static int
+sys_mmap (const uint32_t args[]) 
+{
+  struct file *file = get_data_file (args[0]);
+
+  if (file == NULL)
+    return -1;
+  return process_mmap (file, (void *) args[1]);
+}
+
+/* Munmap system call. */
+static int
+sys_munmap (const uint32_t args[]) 
+{
+  process_munmap (args[0]);
+  return 0;
+}
+#endif
+
+/* Chdir system call. */
+static int
+sys_chdir (const uint32_t args[]) 
+{
+  char *name = copy_in_string ((const char *) args[0]);
+  bool success;
+
+  success = filesys_chdir (name);
+  palloc_free_page (name);
+  return success;
+}
+
+/* Mkdir system call. */
+static int
+sys_mkdir (const uint32_t args[]) 
+{
+  char *name = copy_in_string ((const char *) args[0]);
+  bool success;
+
+  success = filesys_mkdir (name);
+  palloc_free_page (name);
+  return success;
+}
+
+/* Readdir system call.  The directory's position is kept as
+   the position of the file open as the fd. */
+static int
+sys_readdir (const uint32_t args[]) 
+{
+  struct file *file = process_get_file (args[0]);
+  char *uname = (char *) args[1];
+  char name[NAME_MAX + 1];
+  struct dir *dir;
+  bool success = false;
+
+  check_user_buffer (uname, sizeof name, true);
+  if (file == NULL)
+    return false;
+
+  dir = dir_open (inode_reopen (file_get_inode (file)));
+  if (dir != NULL)
+    {
+      dir_seek (dir, file_tell (file));
+      success = dir_readdir (dir, name);
+      file_seek (file, dir_tell (dir));
+      dir_close (dir);
+    }
+
+  if (success)
+    strlcpy (uname, name, sizeof name);
+  return success;
+}
+
+/* Isdir system call. */
+static int
+sys_isdir (const uint32_t args[]) 
+{
+  struct file *file = process_get_file (args[0]);
+
+  return file != NULL && inode_is_dir (file_get_inode (file));
+}
+
+/* Inumber system call. */
+static int
+sys_inumber (const uint32_t args[]) 
+{
+  struct file *file = process_get_file (args[0]);
+
+  if (file == NULL)
+    return -1;
+  return inode_get_inumber (file_get_inode (file));
+}
+
+/* Null system call, for measuring system call overhead. */
+static int
+sys_null (const uint32_t args[] UNUSED) 
+{
+  return 0;
+}
+
+/* Uptime system call. */
+static int
+sys_uptime (const uint32_t args[] UNUSED) 
+{
+  return timer_ticks ();
+}
+
+/* Scheduler trace system call. */
+static int
+sys_sched_trace (const uint32_t args[] UNUSED) 
+{
+  thread_print_trace ();
+  return 0;
+}
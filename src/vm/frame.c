@@ -0,0 +1,200 @@
+#include "vm/frame.h"
+#include <stdio.h>
+#include "vm/page.h"
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Frame table.
+
+   Every page in the user pool is claimed by frame_init() and
+   handed out from here, so that when memory runs out a frame
+   can be taken from some process's page instead of failing.
+   Each frame records the page it holds, and so the owning
+   thread, its page directory, and the user address.
+
+   Victims are chosen in clock (second chance) order: the hand
+   sweeps the table, passing over and clearing the accessed bit
+   of each page that was touched since the hand last passed it,
+   and evicts the first one that was not.
+
+   A frame's lock is held while its page is being read in or
+   written out, and by system calls that have pinned a user
+   buffer with page_lock(), so such frames are never chosen as
+   victims.  SCAN_LOCK serializes searches of the table but is
+   not held while a victim is written out. */
+
+static struct frame *frames;
+static size_t frame_cnt;
+
+static struct lock scan_lock;
+static size_t hand;
+
+/* Statistics. */
+static long long eviction_cnt;          /* Pages evicted. */
+static long long alloc_fail_cnt;        /* Allocations that failed. */
+
+/* Initializes the frame table, taking every page in the user
+   pool. */
+void
+frame_init (void)
+{
+  void *base;
+
+  lock_init (&scan_lock);
+
+  frames = malloc (sizeof *frames * init_ram_pages);
+  if (frames == NULL)
+    PANIC ("out of memory allocating page frames");
+
+  while ((base = palloc_get_page (PAL_USER)) != NULL)
+    {
+      struct frame *f = &frames[frame_cnt++];
+      lock_init (&f->lock);
+      f->base = base;
+      f->page = NULL;
+    }
+}
+
+/* Prints frame table statistics. */
+void
+frame_print_stats (void)
+{
+  printf ("Frames: %zu frames, %lld evictions, %lld failed allocations\n",
+          frame_cnt, eviction_cnt, alloc_fail_cnt);
+}
+
+/* Tries to allocate and lock a frame for PAGE.
+   Returns the frame if successful, a null pointer on failure. */
+static struct frame *
+try_frame_alloc_and_lock (struct page *page)
+{
+  size_t i;
+
+  lock_acquire (&scan_lock);
+
+  /* Find a free frame. */
+  for (i = 0; i < frame_cnt; i++)
+    {
+      struct frame *f = &frames[i];
+      if (!lock_try_acquire (&f->lock))
+        continue;
+      if (f->page == NULL)
+        {
+          f->page = page;
+          lock_release (&scan_lock);
+          return f;
+        }
+      lock_release (&f->lock);
+    }
+
+  /* No free frame.  Find a frame to evict.  Two sweeps give every
+     page one chance to have its accessed bit cleared and then be
+     chosen. */
+  for (i = 0; i < frame_cnt * 2; i++)
+    {
+      /* Get a frame. */
+      struct frame *f = &frames[hand];
+      if (++hand >= frame_cnt)
+        hand = 0;
+
+      if (!lock_try_acquire (&f->lock))
+        continue;
+
+      if (f->page == NULL)
+        {
+          f->page = page;
+          lock_release (&scan_lock);
+          return f;
+        }
+
+      if (page_accessed_recently (f->page))
+        {
+          lock_release (&f->lock);
+          continue;
+        }
+
+      /* Evict this frame, without holding SCAN_LOCK while its
+         page is written out.  If it cannot be evicted, keep
+         looking. */
+      lock_release (&scan_lock);
+      if (page_out (f->page))
+        {
+          eviction_cnt++;
+          f->page = page;
+          return f;
+        }
+      lock_release (&f->lock);
+      lock_acquire (&scan_lock);
+    }
+
+  lock_release (&scan_lock);
+  return NULL;
+}
+
+/* Tries really hard to allocate and lock a frame for PAGE.
+   Returns the frame if successful, a null pointer on failure. */
+struct frame *
+frame_alloc_and_lock (struct page *page)
+{
+  size_t try;
+
+  for (try = 0; try < 3; try++)
+    {
+      struct frame *f = try_frame_alloc_and_lock (page);
+      if (f != NULL)
+        {
+          ASSERT (lock_held_by_current_thread (&f->lock));
+          return f;
+        }
+
+      /* Every frame is busy or cannot be evicted.  Give the
+         threads holding them a chance to let go. */
+      timer_msleep (1000);
+    }
+
+  alloc_fail_cnt++;
+  return NULL;
+}
+
+/* Locks P's frame into memory, if it has one.
+   Upon return, p->frame will not change until P is unlocked. */
+void
+frame_lock (struct page *p)
+{
+  /* A frame can be asynchronously removed, but never inserted. */
+  struct frame *f = p->frame;
+  if (f != NULL)
+    {
+      lock_acquire (&f->lock);
+      if (f != p->frame)
+        {
+          lock_release (&f->lock);
+          ASSERT (p->frame == NULL);
+        }
+    }
+}
+
+/* Releases frame F for use by another page.
+   F must be locked for use by the current process.
+   Any data in F is lost. */
+void
+frame_free (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  f->page = NULL;
+  lock_release (&f->lock);
+}
+
+/* Unlocks frame F, allowing it to be evicted.
+   F must be locked for use by the current process. */
+void
+frame_unlock (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  lock_release (&f->lock);
+}
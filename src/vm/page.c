@@ -0,0 +1,369 @@
+#include "vm/page.h"
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+
+/* Supplemental page table.
+
+   Each user process keeps a hash table of `struct page's, keyed
+   by user virtual address, describing every page in its address
+   space, whether or not it is in memory.  Loading a program only
+   records where each of its pages comes from; page_fault() calls
+   page_in() to bring a page into memory the first time it is
+   touched.  Starting a process thus costs time in proportion to
+   the pages it uses, not to the size of its executable.
+
+   Frames come from the frame table, which may take them back
+   with page_out() when memory runs short.  A page that can be
+   recreated from its file is simply dropped.  A modified page of
+   a memory-mapped file is written back to the file.  Any other
+   page is written to swap, and page_in() reads it back from
+   there.
+
+   The stack starts out as a single page and grows on demand: a
+   fault on a missing page within the stack region that is no
+   more than 32 bytes below the user stack pointer, as the PUSHA
+   instruction may make, gets a new zero page. */
+
+/* Limit on the size of a user stack, in pages. */
+size_t stack_page_limit = STACK_PAGES_DEFAULT;
+
+/* Creates an empty supplemental page table for the running
+   thread.  Returns true if successful, false if memory
+   allocation fails. */
+bool
+page_table_create (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->pages == NULL);
+  t->pages = malloc (sizeof *t->pages);
+  if (t->pages == NULL)
+    return false;
+  if (!hash_init (t->pages, page_hash, page_less, NULL))
+    {
+      free (t->pages);
+      t->pages = NULL;
+      return false;
+    }
+  return true;
+}
+
+/* Frees page P and its frame or swap slot, if any, and removes
+   the page from the running thread's page directory, so that the
+   frame is not freed again along with the page directory.  A
+   page that is not private is first written back to its file if
+   it was modified. */
+static void
+destroy_page (struct page *p)
+{
+  frame_lock (p);
+  if (p->frame != NULL)
+    {
+      uint32_t *pd = p->thread->pagedir;
+      if (!p->private && pagedir_is_dirty (pd, p->addr))
+        file_write_at (p->file, p->frame->base, p->file_bytes,
+                       p->file_offset);
+      pagedir_clear_page (pd, p->addr);
+      frame_free (p->frame);
+    }
+  else
+    swap_discard (p);
+  free (p);
+}
+
+/* Destroys page P_, for hash_destroy(). */
+static void
+destroy_page_elem (struct hash_elem *p_, void *aux UNUSED)
+{
+  destroy_page (hash_entry (p_, struct page, hash_elem));
+}
+
+/* Destroys the running thread's supplemental page table and
+   frees all of its pages.  Must be called before the thread's
+   page directory is destroyed. */
+void
+page_exit (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->pages != NULL)
+    {
+      hash_destroy (t->pages, destroy_page_elem);
+      free (t->pages);
+      t->pages = NULL;
+    }
+}
+
+/* Returns the running thread's page containing ADDRESS, or a
+   null pointer if there is none.  If ADDRESS looks like an
+   access to the stack, allocates a new stack page for it. */
+static struct page *
+page_for_addr (const void *address)
+{
+  struct thread *t = thread_current ();
+  struct page p;
+  struct hash_elem *e;
+
+  if (t->pages == NULL || !is_user_vaddr (address))
+    return NULL;
+  p.addr = pg_round_down (address);
+  e = hash_find (t->pages, &p.hash_elem);
+  if (e != NULL)
+    return hash_entry (e, struct page, hash_elem);
+
+  /* Grow the stack if ADDRESS is within the stack region and no
+     more than 32 bytes below the user stack pointer.  A fault
+     taken inside a system call checks against the stack pointer
+     saved on entry to the system call. */
+  if ((uintptr_t) PHYS_BASE - (uintptr_t) p.addr
+      <= stack_page_limit * PGSIZE
+      && (uintptr_t) address + 32 >= (uintptr_t) t->user_esp)
+    return page_allocate (p.addr, true);
+  return NULL;
+}
+
+/* Adds a page at user virtual address UPAGE to the running
+   thread's supplemental page table, initially all zeros and not
+   in memory.  The caller may set the page's file members to give
+   it other initial contents.  Returns the new page, or a null
+   pointer if UPAGE already has a page or memory allocation
+   fails. */
+struct page *
+page_allocate (void *upage, bool writable)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return NULL;
+  p->addr = upage;
+  p->writable = writable;
+  p->thread = t;
+  p->frame = NULL;
+  p->file = NULL;
+  p->file_offset = 0;
+  p->file_bytes = 0;
+  p->sector = (block_sector_t) -1;
+  p->private = true;
+
+  if (hash_insert (t->pages, &p->hash_elem) != NULL)
+    {
+      free (p);
+      return NULL;
+    }
+  return p;
+}
+
+/* Removes the running thread's page at user virtual address
+   UPAGE from its supplemental page table and frees it, writing
+   it back to its file first if it is not private and has been
+   modified.  UPAGE must have a page. */
+void
+page_deallocate (void *upage)
+{
+  struct page *p = page_for_addr (upage);
+
+  ASSERT (p != NULL);
+  hash_delete (thread_current ()->pages, &p->hash_elem);
+  destroy_page (p);
+}
+
+/* Locks a frame for page P and reads its contents into it.
+   Returns true if successful, false on failure. */
+static bool
+do_page_in (struct page *p)
+{
+  /* Get a frame for the page. */
+  p->frame = frame_alloc_and_lock (p);
+  if (p->frame == NULL)
+    return false;
+
+  /* Copy data into the frame. */
+  if (p->sector != (block_sector_t) -1)
+    {
+      /* Get data from swap. */
+      swap_in (p);
+      return true;
+    }
+  if (p->file != NULL
+      && file_read_at (p->file, p->frame->base, p->file_bytes,
+                       p->file_offset) != p->file_bytes)
+    {
+      frame_free (p->frame);
+      p->frame = NULL;
+      return false;
+    }
+  memset ((uint8_t *) p->frame->base + p->file_bytes, 0,
+          PGSIZE - p->file_bytes);
+  return true;
+}
+
+/* Brings the running thread's page containing FAULT_ADDR into
+   memory and maps it in the thread's page directory.  Returns
+   true if successful, false if FAULT_ADDR has no page or no
+   memory is available, in which case the access that faulted
+   is an error. */
+bool
+page_in (void *fault_addr)
+{
+  struct page *p = page_for_addr (fault_addr);
+  bool success;
+
+  if (p == NULL)
+    return false;
+
+  frame_lock (p);
+  if (p->frame == NULL)
+    {
+      if (!do_page_in (p))
+        return false;
+    }
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  /* Install frame into page table.  A page faulted in by another
+     access while it was locked is already installed. */
+  success = (pagedir_get_page (p->thread->pagedir, p->addr) != NULL
+             || pagedir_set_page (p->thread->pagedir, p->addr,
+                                  p->frame->base, p->writable));
+
+  /* Release frame. */
+  frame_unlock (p->frame);
+
+  return success;
+}
+
+/* Evicts page P, which must have a locked frame.  Returns true
+   if successful, false if the page could not be written to swap
+   or to its file. */
+bool
+page_out (struct page *p)
+{
+  uint32_t *pd = p->thread->pagedir;
+  bool dirty;
+  bool ok;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  /* Mark page not present in page table, forcing accesses by the
+     process to fault.  This must happen before checking the
+     dirty bit, to prevent a race with the process dirtying the
+     page. */
+  pagedir_clear_page (pd, p->addr);
+
+  /* Has the frame been modified? */
+  dirty = pagedir_is_dirty (pd, p->addr);
+
+  /* An unmodified page with a file behind it can be read again
+     from the file.  A modified page that is not private goes
+     back to its file.  Anything else, including a zero page,
+     goes to swap. */
+  if (p->file == NULL)
+    ok = swap_out (p);
+  else if (!dirty)
+    ok = true;
+  else if (p->private)
+    ok = swap_out (p);
+  else
+    ok = (file_write_at (p->file, p->frame->base, p->file_bytes,
+                         p->file_offset) == p->file_bytes);
+
+  if (ok)
+    p->frame = NULL;
+  else
+    {
+      /* Put it back as it was. */
+      pagedir_set_page (pd, p->addr, p->frame->base, p->writable);
+      pagedir_set_dirty (pd, p->addr, dirty);
+    }
+  return ok;
+}
+
+/* Returns true if page P's data has been accessed recently,
+   false otherwise, and clears the accessed bit.
+   P must have a frame locked into memory. */
+bool
+page_accessed_recently (struct page *p)
+{
+  bool was_accessed;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  was_accessed = pagedir_is_accessed (p->thread->pagedir, p->addr);
+  if (was_accessed)
+    pagedir_set_accessed (p->thread->pagedir, p->addr, false);
+  return was_accessed;
+}
+
+/* Tries to lock the page containing ADDR into physical memory.
+   If WILL_WRITE is true, the page must be writable; otherwise
+   it may be read-only.  Returns true if successful, false on
+   failure.  A system call locks the pages of a user buffer
+   before handing it to the file system, so that they stay in
+   memory, and are not chosen for eviction, while the file
+   system's locks are held. */
+bool
+page_lock (const void *addr, bool will_write)
+{
+  struct page *p = page_for_addr (addr);
+
+  if (p == NULL || (!p->writable && will_write))
+    return false;
+
+  frame_lock (p);
+  if (p->frame == NULL)
+    {
+      if (!do_page_in (p))
+        return false;
+      if (!pagedir_set_page (p->thread->pagedir, p->addr,
+                             p->frame->base, p->writable))
+        {
+          frame_free (p->frame);
+          p->frame = NULL;
+          return false;
+        }
+    }
+  return true;
+}
+
+/* Unlocks a page locked with page_lock(). */
+void
+page_unlock (const void *addr)
+{
+  struct page *p = page_for_addr (addr);
+
+  ASSERT (p != NULL);
+  frame_unlock (p->frame);
+}
+
+/* Returns a hash value for the page that P_ refers to. */
+unsigned
+page_hash (const struct hash_elem *p_, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (p_, struct page, hash_elem);
+  return ((uintptr_t) p->addr) >> PGBITS;
+}
+
+/* Returns true if page A precedes page B. */
+bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, hash_elem);
+  const struct page *b = hash_entry (b_, struct page, hash_elem);
+
+  return a->addr < b->addr;
+}
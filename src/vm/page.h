@@ -0,0 +1,72 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Default limit on the size of a user stack, in pages: 8 MB. */
+#define STACK_PAGES_DEFAULT 2048
+
+/* Limit on the size of a user stack, in pages.
+   Controlled by kernel command-line option "-stack=COUNT". */
+extern size_t stack_page_limit;
+
+/* A page of a user process's virtual memory, as recorded in the
+   process's supplemental page table.
+
+   A page that is not in memory is brought in from wherever its
+   contents live: swap, starting at SECTOR, if it has been
+   swapped out; otherwise FILE, starting at FILE_OFFSET, for
+   FILE_BYTES bytes, with the rest of the page zeroed.  A page
+   with neither is all zeros.
+
+   A modified private page goes to swap when it is evicted.  A
+   page that is not private, such as a page of a memory-mapped
+   file, is written back to FILE instead, and only if it was
+   modified. */
+struct page
+  {
+    /* Immutable members. */
+    void *addr;                 /* User virtual address. */
+    bool writable;              /* Writable by the process? */
+    struct thread *thread;      /* Owning thread. */
+
+    /* Accessed only in owning process context. */
+    struct hash_elem hash_elem; /* Element in thread's `pages'. */
+
+    /* Set only in owning process context with frame->lock held.
+       Cleared only with scan_lock and frame->lock held. */
+    struct frame *frame;        /* Page frame, or null if not in
+                                   memory. */
+
+    /* Where the page's contents come from.  Protected by
+       frame->lock. */
+    struct file *file;          /* File, or null for zeros. */
+    off_t file_offset;          /* Offset in file. */
+    off_t file_bytes;           /* Bytes to read, 0...PGSIZE. */
+    block_sector_t sector;      /* Starting sector of swap slot,
+                                   or -1 if not in swap. */
+    bool private;               /* True to write back to swap,
+                                   false to write back to FILE. */
+  };
+
+bool page_table_create (void);
+void page_exit (void);
+
+struct page *page_allocate (void *upage, bool writable);
+void page_deallocate (void *upage);
+
+bool page_in (void *fault_addr);
+bool page_out (struct page *);
+bool page_accessed_recently (struct page *);
+
+bool page_lock (const void *, bool will_write);
+void page_unlock (const void *);
+
+hash_hash_func page_hash;
+hash_less_func page_less;
+
+#endif /* vm/page.h */
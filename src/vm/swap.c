@@ -0,0 +1,116 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "devices/block.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Swap space.
+
+   The BLOCK_SWAP device is divided into slots of PAGE_SECTORS
+   consecutive sectors, one page each, and a bitmap records
+   which slots are in use.  A page is written out or read back
+   with a single multi-sector request, which the block layer
+   turns into a single disk command (a DMA transfer straight
+   from or to the frame, when DMA is enabled) instead of one
+   command per sector. */
+
+/* The swap device. */
+static struct block *swap_device;
+
+/* Used swap slots. */
+static struct bitmap *swap_bitmap;
+
+/* Protects swap_bitmap. */
+static struct lock swap_lock;
+
+/* Number of sectors per page. */
+#define PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Statistics. */
+static long long swap_in_cnt;           /* Pages read back. */
+static long long swap_out_cnt;          /* Pages written out. */
+
+/* Sets up swap. */
+void
+swap_init (void)
+{
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device == NULL)
+    {
+      printf ("no swap device--swap disabled\n");
+      swap_bitmap = bitmap_create (0);
+    }
+  else
+    swap_bitmap = bitmap_create (block_size (swap_device) / PAGE_SECTORS);
+  if (swap_bitmap == NULL)
+    PANIC ("couldn't create swap bitmap");
+  lock_init (&swap_lock);
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void)
+{
+  printf ("Swap: %lld pages out, %lld pages in, %zu of %zu slots in use\n",
+          swap_out_cnt, swap_in_cnt,
+          bitmap_count (swap_bitmap, 0, bitmap_size (swap_bitmap), true),
+          bitmap_size (swap_bitmap));
+}
+
+/* Swaps in page P, which must have a locked frame
+   (and be swapped out), and frees its swap slot. */
+void
+swap_in (struct page *p)
+{
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+  ASSERT (p->sector != (block_sector_t) -1);
+
+  block_read_multiple (swap_device, p->sector, PAGE_SECTORS, p->frame->base);
+  swap_discard (p);
+  swap_in_cnt++;
+}
+
+/* Swaps out page P, which must have a locked frame.  From then
+   on P lives in swap, even if it came from a file.  Returns true
+   if successful, false if swap is full. */
+bool
+swap_out (struct page *p)
+{
+  size_t slot;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  lock_acquire (&swap_lock);
+  slot = bitmap_scan_and_flip (swap_bitmap, 0, 1, false);
+  lock_release (&swap_lock);
+  if (slot == BITMAP_ERROR)
+    return false;
+
+  p->sector = slot * PAGE_SECTORS;
+  block_write_multiple (swap_device, p->sector, PAGE_SECTORS,
+                        p->frame->base);
+  p->file = NULL;
+  p->file_offset = 0;
+  p->file_bytes = 0;
+  swap_out_cnt++;
+  return true;
+}
+
+/* Frees page P's swap slot, if it has one. */
+void
+swap_discard (struct page *p)
+{
+  if (p->sector == (block_sector_t) -1)
+    return;
+
+  lock_acquire (&swap_lock);
+  bitmap_reset (swap_bitmap, p->sector / PAGE_SECTORS);
+  lock_release (&swap_lock);
+  p->sector = (block_sector_t) -1;
+}